@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -16,6 +16,7 @@
 
 #include "types.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
@@ -23,31 +24,279 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+// The cache is split into NBUCKET hash buckets by block number,
+// each with its own lock and list of buffers, so that lookups
+// of different blocks don't contend. A buffer's refcnt and list
+// links are protected by the lock of the bucket it is in.
+//
+// The cache grows on demand. Buffer headers come from a slab
+// cache; block data lives in whole pages from kalloc(), each
+// split into PGSIZE/BSIZE buffers. Buffers that hold no block
+// wait on a free list. Once the cache has maxbuf buffers (a
+// 1/BCACHEFRAC share of RAM), a miss recycles the least recently
+// released unreferenced buffer instead, locking one bucket at a
+// time to find it. When kalloc() runs out of memory, it calls
+// bcache_reclaim() to drop unreferenced blocks and give back a
+// page, down to a floor of NBUF buffers.
+
+#define NBUCKET 31
+#define BPP (PGSIZE / BSIZE)  // buffers per data page
+
+#if BSIZE > PGSIZE
+#error "BSIZE must fit in a page"
+#endif
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;  // list of buffers, through prev/next
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;       // protects free and nbuf
+  struct buf *free;           // buffers holding no block, through next
+  int nbuf;                   // buffers allocated
+  int maxbuf;                 // most buffers the cache grows to
+  struct kmem_cache *cache;   // buffer headers
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+// dev of a buffer that holds no block.
+#define NODEV (~0U)
+
+static struct bucket*
+bhash(uint blockno)
+{
+  return &bcache.bucket[blockno % NBUCKET];
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+static void
+blink(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// Put b, which holds no block, on the free list.
+static void
+bputfree(struct buf *b)
+{
+  b->dev = NODEV;
+  acquire(&bcache.lock);
+  b->next = bcache.free;
+  bcache.free = b;
+  release(&bcache.lock);
+}
+
+// Add a page's worth of buffers to the free list.
+// The caller has already counted them in bcache.nbuf.
+// Returns 0 if out of memory.
+static int
+bgrow(void)
+{
+  struct buf *b[BPP];
+  char *page;
+  int i;
+
+  if((page = kalloc()) == 0)
+    return 0;
+  for(i = 0; i < BPP; i++){
+    if((b[i] = kmem_cache_alloc(bcache.cache)) == 0){
+      while(--i >= 0)
+        kmem_cache_free(bcache.cache, b[i]);
+      kfree(page);
+      return 0;
+    }
+  }
+  for(i = 0; i < BPP; i++){
+    // buffers come and go, so their locks aren't
+    // registered with initlock(); see spinlock.c.
+    memset(b[i], 0, sizeof(*b[i]));
+    b[i]->lock.name = "buffer";
+    b[i]->data = (uchar*)page + i*BSIZE;
+    bputfree(b[i]);
+  }
+  return 1;
+}
+
+// Take a buffer from the free list, growing the cache
+// if the list is empty and the cache is below maxbuf.
+// Returns 0 if there's no free buffer.
+static struct buf*
+bnew(void)
+{
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  if(bcache.free == 0 && bcache.nbuf + BPP <= bcache.maxbuf){
+    bcache.nbuf += BPP;
+    release(&bcache.lock);
+    // kalloc() may call bcache_reclaim(), so
+    // don't hold any bcache lock.
+    if(bgrow() == 0){
+      acquire(&bcache.lock);
+      bcache.nbuf -= BPP;
+      release(&bcache.lock);
+    }
+    acquire(&bcache.lock);
+  }
+  b = bcache.free;
+  if(b)
+    bcache.free = b->next;
+  release(&bcache.lock);
+  return b;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf));
+  bcache.maxbuf = (PHYSTOP - KERNBASE) / BCACHEFRAC / BSIZE;
+  if(bcache.maxbuf < NBUF)
+    bcache.maxbuf = NBUF;
+
+  // the log needs NBUF buffers even when memory is short: it
+  // can keep a block pinned for each slot of its ring, plus the
+  // open transaction's blocks and the frozen copies of the one
+  // being committed, and FS calls in progress hold a few more.
+  while(bcache.nbuf < NBUF){
+    bcache.nbuf += BPP;
+    if(bgrow() == 0)
+      panic("binit");
+  }
+}
+
+// Look for block blockno of dev in bucket bk.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Find the least recently used buffer with no references
+// and no disk read in progress, remove it from its bucket,
+// and return it; 0 if there is none.
+// Holds one bucket lock at a time, so the buffer may be
+// taken by someone else between the scan and the claim;
+// in that case, scan again.
+static struct buf*
+bvictim(void)
+{
+  struct bucket *bk, *best;
+  struct buf *b, *victim;
+  uint t;
+
+  for(;;){
+    best = 0;
+    victim = 0;
+    t = 0;
+    for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+      acquire(&bk->lock);
+      for(b = bk->head.next; b != &bk->head; b = b->next){
+        if(b->refcnt == 0 && !b->disk && (victim == 0 || b->lastuse < t)){
+          best = bk;
+          victim = b;
+          t = b->lastuse;
+        }
+      }
+      release(&bk->lock);
+    }
+    if(victim == 0)
+      return 0;
+
+    acquire(&best->lock);
+    for(b = best->head.next; b != &best->head; b = b->next){
+      if(b == victim && b->refcnt == 0 && !b->disk){
+        bunlink(b);
+        release(&best->lock);
+        return b;
+      }
+    }
+    release(&best->lock);
+  }
+}
+
+// If all the buffers of some data page are on the free
+// list, free them and the page. Returns 1 if it did.
+static int
+bfreepage(void)
+{
+  struct buf *b, *c, **pp, *gone[BPP];
+  char *page;
+  int n;
+
+  acquire(&bcache.lock);
+  for(b = bcache.free; b; b = b->next){
+    page = (char*)PGROUNDDOWN((uint64)b->data);
+    n = 0;
+    for(c = bcache.free; c; c = c->next)
+      if((char*)PGROUNDDOWN((uint64)c->data) == page)
+        n++;
+    if(n < BPP)
+      continue;
+
+    n = 0;
+    for(pp = &bcache.free; *pp; ){
+      if((char*)PGROUNDDOWN((uint64)(*pp)->data) == page){
+        gone[n++] = *pp;
+        *pp = (*pp)->next;
+      } else {
+        pp = &(*pp)->next;
+      }
+    }
+    bcache.nbuf -= BPP;
+    release(&bcache.lock);
+    for(n = 0; n < BPP; n++)
+      kmem_cache_free(bcache.cache, gone[n]);
+    kfree(page);
+    return 1;
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
+// Shrink the cache by one page, dropping unreferenced
+// blocks, least recently used first, until a whole page
+// of buffers is free. Called by kalloc() when it's out of
+// memory, so it must not allocate.
+// Returns 1 if a page was freed, 0 if not.
+int
+bcache_reclaim(void)
+{
+  struct buf *b;
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  if(bcache.cache == 0)
+    return 0;  // called before binit()
+  for(;;){
+    if(bfreepage())
+      return 1;
+    if(bcache.nbuf - BPP < NBUF)
+      return 0;
+    if((b = bvictim()) == 0)
+      return 0;
+    bputfree(b);
   }
 }
 
@@ -57,33 +306,43 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct bucket *bk = bhash(blockno);
+  struct buf *b, *victim;
 
-  acquire(&bcache.lock);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached; recycle an unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached; use a new buffer if the cache can
+  // grow, else recycle an unused one.
+  if((victim = bnew()) == 0 && (victim = bvictim()) == 0)
+    panic("bget: no buffers");
+
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    // someone else cached the block meanwhile.
+    b->refcnt++;
+    release(&bk->lock);
+    bputfree(victim);
+    acquiresleep(&b->lock);
+    return b;
   }
-  panic("bget: no buffers");
+  b = victim;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  blink(bk, b);
+  release(&bk->lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -93,13 +352,93 @@ bread(uint dev, uint blockno)
   struct buf *b;
 
   b = bget(dev, blockno);
-  if(!b->valid) {
+  if(b->disk)
+    virtio_disk_wait(b->dev, b);  // read-ahead in progress
+  if(!b->valid)
     virtio_disk_rw(b->dev, b, 0);
-    b->valid = 1;
-  }
   return b;
 }
 
+// Return a locked buf for the indicated block, without
+// reading it from disk, for a caller that is about to
+// overwrite all of its contents.
+struct buf*
+bgetnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(b->disk)
+    virtio_disk_wait(b->dev, b);  // read-ahead in progress
+  b->valid = 1;
+  return b;
+}
+
+// Start I/O on locked bufs bs[0..n-1], merging runs of
+// consecutive blocks into single disk requests of up to
+// MAXIOBLOCKS blocks. Doesn't wait.
+static void
+bsubmitv(struct buf **bs, int n, int write)
+{
+  int i, j;
+
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n && j - i < MAXIOBLOCKS; j++)
+      if(bs[j]->dev != bs[i]->dev || bs[j]->blockno != bs[j-1]->blockno + 1)
+        break;
+    virtio_disk_submitv(bs[i]->dev, &bs[i], j - i, write);
+  }
+}
+
+// Fetch blocks blocks[0..n-1] of dev into the cache, for
+// reads that are expected soon. Blocks that are already
+// cached, or being read by someone else, are skipped rather
+// than waited for. Doesn't wait for the disk either: the
+// buffers are released with their reads in progress, and
+// bread() waits if need be. Adjacent blocks are read with
+// one disk request.
+void
+breadaheadv(uint dev, uint *blocks, int n)
+{
+  struct buf *bs[MAXIOBLOCKS], *b;
+  struct bucket *bk;
+  int i, nb;
+
+  nb = 0;
+  for(i = 0; i < n; i++){
+    bk = bhash(blocks[i]);
+    acquire(&bk->lock);
+    b = bfind(bk, dev, blocks[i]);
+    release(&bk->lock);
+    if(b)
+      continue;
+
+    b = bget(dev, blocks[i]);
+    if(b->valid || b->disk){
+      brelse(b);
+      continue;
+    }
+    bs[nb++] = b;
+    if(nb == MAXIOBLOCKS){
+      bsubmitv(bs, nb, 0);
+      while(nb > 0)
+        brelse(bs[--nb]);
+    }
+  }
+  if(nb > 0){
+    bsubmitv(bs, nb, 0);
+    while(nb > 0)
+      brelse(bs[--nb]);
+  }
+}
+
+// Read ahead a single block.
+void
+breadahead(uint dev, uint blockno)
+{
+  breadaheadv(dev, &blockno, 1);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -109,43 +448,93 @@ bwrite(struct buf *b)
   virtio_disk_rw(b->dev, b, 1);
 }
 
+// Start writing b's contents to disk, without waiting,
+// so that a batch of writes can be outstanding at once.
+// Must be locked, and stay locked until bwait(b).
+void
+bwrite_async(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_async");
+  virtio_disk_submit(b->dev, b, 1);
+}
+
+// Write locked bufs bs[0..n-1] to disk, adjacent
+// blocks in one request, and wait for all of them.
+void
+bwritev(struct buf **bs, int n)
+{
+  for(int i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  bsubmitv(bs, n, 1);
+  for(int i = 0; i < n; i++)
+    bwait(bs[i]);
+}
+
+// Wait for the disk to finish with b.
+void
+bwait(struct buf *b)
+{
+  virtio_disk_wait(b->dev, b);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Note when it was last used, for recycling.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = ticks;
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
+// The log pins a block in the cache from log_write()
+// until the block is installed at its home location.
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  b->pins++;
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  b->pins--;
+  release(&bk->lock);
 }
 
+// Is block blockno of dev pinned by the log, i.e. does
+// the log hold a copy of it that isn't installed yet?
+int
+bpinned(uint dev, uint blockno)
+{
+  struct bucket *bk = bhash(blockno);
+  struct buf *b;
+  int pinned;
 
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  pinned = b && b->pins > 0;
+  release(&bk->lock);
+  return pinned;
+}
@@ -262,7 +262,7 @@ bd_initfree(void *bd_left, void *bd_right) {
     int left = blk_index_next(k, bd_left);
     int right = blk_index(k, bd_right);
     free += bd_initfree_pair(k, left);
-    if(right <= left)
+    if(right <= left || right >= NBLK(k))
       continue;
     free += bd_initfree_pair(k, right);
   }
@@ -5,8 +5,10 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint pins;    // references held by the log, see bpin()
+  uint lastuse; // ticks when refcnt last dropped to zero
+  struct buf *prev; // hash bucket list
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data;  // BSIZE bytes, part of a page from kalloc()
 };
 
@@ -1,5 +1,7 @@
 struct buf;
 struct context;
+struct kmem_cache;
+struct kmemstat;
 struct file;
 struct inode;
 struct pipe;
@@ -7,15 +9,24 @@ struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct statfs;
 struct superblock;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bgetnew(uint, uint);
+void            breadahead(uint, uint);
+void            breadaheadv(uint, uint*, int);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwrite_async(struct buf*);
+void            bwritev(struct buf**, int);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bpinned(uint, uint);
+int             bcache_reclaim(void);
 
 // console.c
 void            consoleinit(void);
@@ -36,14 +47,19 @@ int             filewrite(struct file*, uint64, int n);
 
 // fs.c
 void            fsinit(int);
+void            bfree_commit(uint, uint, uint);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, char*, uint);
+void            fsstat(uint, struct statfs*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilock_shared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            iunlock_shared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
@@ -60,8 +76,12 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
 void            kfree(void *);
 void            kinit();
+void            kincref(void *);
+int             krefcnt(void *);
+int             kzero_refill(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -69,8 +89,20 @@ void            log_write(struct buf*);
 void            begin_op(int);
 void            end_op(int);
 void            crash_op(int,int);
+void            log_free(int, uint, uint);
+
+// mmap.c
+void            mmapinit(void);
+uint64          mmap(uint64, int, int, int, struct file*, int);
+int             munmap(uint64, int);
+int             mmapfault(struct proc*, uint64, int);
+int             mmapcopy(struct proc*, struct proc*);
+void            munmapall(struct proc*);
+void            pcache_update(struct inode*, uint, char*, uint);
+void            pcache_inval(struct inode*);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -89,6 +121,7 @@ int             growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+void            kthread(char*, void (*)(int), int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -117,9 +150,19 @@ void            push_off(void);
 void            pop_off(void);
 uint64          sys_ntas(void);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+int             kmem_cache_stat(int, struct kmemstat*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
+void            acquiresleep_shared(struct sleeplock*);
+void            releasesleep_shared(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
@@ -159,12 +202,16 @@ void            kvminithart(void);
 uint64          kvmpa(uint64);
 void            kvmmap(uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+pte_t*          walk(pagetable_t, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             cowfault(pagetable_t, uint64);
+int             uvmfault(pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
+void            uvmprefault(pagetable_t, uint64, uint64, int);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
@@ -181,6 +228,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(int);
 void            virtio_disk_rw(int, struct buf *, int);
+void            virtio_disk_submit(int, struct buf *, int);
+void            virtio_disk_submitv(int, struct buf **, int, int);
+void            virtio_disk_wait(int, struct buf *);
 void            virtio_disk_intr(int);
 
 // number of elements in fixed-size array
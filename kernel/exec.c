@@ -27,7 +27,7 @@ exec(char *path, char **argv)
     end_op(ROOTDEV);
     return -1;
   }
-  ilock(ip);
+  ilock_shared(ip);
 
   // Check ELF header
   if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -56,7 +56,8 @@ exec(char *path, char **argv)
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  iunlock_shared(ip);
+  iput(ip);
   end_op(ROOTDEV);
   ip = 0;
 
@@ -106,6 +107,7 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  munmapall(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
@@ -119,7 +121,8 @@ exec(char *path, char **argv)
   if(pagetable)
     proc_freepagetable(pagetable, sz);
   if(ip){
-    iunlockput(ip);
+    iunlock_shared(ip);
+    iput(ip);
     end_op(ROOTDEV);
   }
   return -1;
@@ -15,14 +15,15 @@
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;        // protects f->ref of all files
+  struct kmem_cache *cache;    // where file structures come from
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -31,16 +32,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +65,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -91,9 +86,9 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilock_shared(f->ip);
     stati(f->ip, &st);
-    iunlock(f->ip);
+    iunlock_shared(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
       return -1;
     return 0;
@@ -111,6 +106,11 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->readable == 0)
     return -1;
 
+  // take any faults on the destination now: a fault on a
+  // mapping of an inode locks it, and pipes and devices
+  // copy out while holding a spinlock.
+  uvmprefault(myproc()->pagetable, addr, n, 1);
+
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -118,10 +118,19 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(f, 1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    if(f->ref == 1){
+      // no other process shares f->off, so readers of the
+      // inode through other files can read at the same time.
+      ilock_shared(f->ip);
+      if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+        f->off += r;
+      iunlock_shared(f->ip);
+    } else {
+      ilock(f->ip);
+      if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+    }
   } else {
     panic("fileread");
   }
@@ -139,6 +148,9 @@ filewrite(struct file *f, uint64 addr, int n)
   if(f->writable == 0)
     return -1;
 
+  // as in fileread(), take faults on the source first.
+  uvmprefault(myproc()->pagetable, addr, n, 0);
+
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -146,13 +158,11 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(f, 1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write a chunk at a time to avoid exceeding
+    // the maximum log transaction size.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = MAXOPWRITE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -169,7 +179,7 @@ filewrite(struct file *f, uint64 addr, int n)
       if(r < 0)
         break;
       if(r != n1)
-        panic("short filewrite");
+        break;  // error from writei
       i += r;
     }
     ret = (i == n ? n : -1);
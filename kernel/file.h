@@ -10,6 +10,13 @@ struct file {
   short minor;       // FD_DEVICE
 };
 
+// most bytes of a file to write in one log transaction.
+// file data isn't logged (see writei()), so a transaction
+// only holds the i-node, its extent spill block, and the
+// allocation bitmap blocks, at most two for a chunk of
+// fewer than BPB blocks.
+#define MAXOPWRITE (4*MAXIOBLOCKS*BSIZE)
+
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
@@ -19,6 +26,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // hash chain, see iget()
+  struct inode *prev; // list of unused inodes
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -27,7 +37,35 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  struct extent ext[NEXTENT];
+  uint spill;
+
+  // readers holding lock shared update these hints,
+  // so they're also protected by hintlock.
+  struct spinlock hintlock;
+  uint xidx;          // extent bmap() last used
+  uint xbn;           // file block it starts at
+
+  uint ranext;        // block a sequential read would start at
+  uint rawin;         // read-ahead window, in blocks; 0 if off
+  uint raend;         // blocks before this have been read ahead
+
+  struct dirindex *dx; // directory's index, or 0; see dxget()
+};
+
+// in-memory index of a directory's entries, see fs.c.
+struct dxent {
+  struct dxent *next;  // in hash chain or list of empty entries
+  uint off;            // byte offset of the dirent
+  ushort inum;         // 0 if the dirent is empty
+  char name[DIRSIZ];
+};
+
+struct dirindex {
+  struct dxent **hash; // chains of entries in use
+  uint nhash;          // number of chains; a power of two
+  uint n;              // entries in use
+  struct dxent *free;  // empty entries
 };
 
 // map major device number to device functions.
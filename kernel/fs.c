@@ -23,6 +23,12 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void freeinit(int);
+static void imapinit(int);
+static void dxfree(struct inode*);
+static void dcacheinit(void);
+static void dpurge(uint, uint);
+static struct kmem_cache *dxcache, *dxentcache;
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -44,7 +50,11 @@ fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  if(sb.bsize != BSIZE)
+    panic("file system block size");
   initlog(dev, &sb);
+  freeinit(dev);
+  imapinit(dev);
 }
 
 // Zero a block.
@@ -60,30 +70,198 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// The free blocks are tracked on disk by the bitmap, and in
+// memory by an index of the free extents, sorted by start,
+// which fsinit() builds from the bitmap. balloc() picks a
+// block with a binary search of the index; the bitmap is
+// still updated through the log, and is what's on disk.
+// bfree() clears the bit at once, but the block only goes
+// back in the index once the transaction that freed it has
+// committed.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+struct {
+  struct spinlock lock;
+  struct extent *ext;  // free extents, by start; never adjacent
+  int n;               // number of free extents
+} freemap;
+
+// Read the bitmap and build the free extent index.
+static void
+freeinit(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, bi;
+
+  initlock(&freemap.lock, "freemap");
+  // at worst every other block is free.
+  freemap.ext = bd_malloc((sb.size / 2 + 1) * sizeof(struct extent));
+  if(freemap.ext == 0)
+    panic("freeinit");
+  freemap.n = 0;
 
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+  for(b = 0; b < sb.size; b++){
+    bi = b % BPB;
+    if(bi == 0){
+      if(bp)
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      bp = bread(dev, BBLOCK(b, sb));
     }
+    if(bp->data[bi/8] & (1 << (bi % 8)))
+      continue;
+    if(freemap.n > 0 && freemap.ext[freemap.n-1].start +
+       freemap.ext[freemap.n-1].len == b){
+      freemap.ext[freemap.n-1].len++;
+    } else {
+      freemap.ext[freemap.n].start = b;
+      freemap.ext[freemap.n].len = 1;
+      freemap.n++;
+    }
+  }
+  if(bp)
     brelse(bp);
+}
+
+// Index of the last free extent that starts at or before b,
+// or -1 if there's none. Caller must hold freemap.lock.
+static int
+freefind(uint b)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = freemap.n;
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(freemap.ext[mid].start <= b)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - 1;
+}
+
+// Remove block b, which is in free extent i, from the index.
+// Caller must hold freemap.lock.
+static void
+freetake(int i, uint b)
+{
+  struct extent *e = &freemap.ext[i];
+
+  if(b == e->start){
+    e->start++;
+    e->len--;
+    if(e->len == 0){
+      memmove(e, e+1, (freemap.n - i - 1) * sizeof(*e));
+      freemap.n--;
+    }
+  } else if(b == e->start + e->len - 1){
+    e->len--;
+  } else {
+    // split e in two.
+    memmove(e+2, e+1, (freemap.n - i - 1) * sizeof(*e));
+    freemap.n++;
+    e[1].start = b + 1;
+    e[1].len = e->start + e->len - (b + 1);
+    e->len = b - e->start;
   }
-  panic("balloc: out of blocks");
+}
+
+// Take a free block out of the index: goal if it's free,
+// or else the first free block after it. Skips blocks that
+// the log has a copy of if data is set; see balloc().
+static uint
+freealloc(uint dev, int data, uint goal)
+{
+  int i, tries;
+  uint b;
+
+  acquire(&freemap.lock);
+  if(freemap.n == 0)
+    panic("balloc: out of blocks");
+  i = freefind(goal);
+  if(i >= 0 && goal < freemap.ext[i].start + freemap.ext[i].len){
+    b = goal;
+  } else {
+    if(++i == freemap.n)
+      i = 0;
+    b = freemap.ext[i].start;
+  }
+  for(tries = 0; data && bpinned(dev, b); tries++){
+    if(tries == sb.size)
+      panic("balloc: out of blocks");
+    if(++b == freemap.ext[i].start + freemap.ext[i].len){
+      if(++i == freemap.n)
+        i = 0;
+      b = freemap.ext[i].start;
+    }
+  }
+  freetake(i, b);
+  release(&freemap.lock);
+  return b;
+}
+
+// Put block b back in the index, merging it with the
+// free extents on either side.
+static void
+freeput(uint b)
+{
+  struct extent *e = freemap.ext;
+  int i;
+
+  acquire(&freemap.lock);
+  i = freefind(b);  // e[i] is before b, e[i+1] after it
+  if(i >= 0 && e[i].start + e[i].len == b){
+    e[i].len++;
+    if(i + 1 < freemap.n && e[i+1].start == b + 1){
+      e[i].len += e[i+1].len;
+      memmove(&e[i+1], &e[i+2], (freemap.n - i - 2) * sizeof(*e));
+      freemap.n--;
+    }
+  } else if(i + 1 < freemap.n && e[i+1].start == b + 1){
+    e[i+1].start--;
+    e[i+1].len++;
+  } else {
+    memmove(&e[i+2], &e[i+1], (freemap.n - i - 1) * sizeof(*e));
+    freemap.n++;
+    e[i+1].start = b;
+    e[i+1].len = 1;
+  }
+  release(&freemap.lock);
+}
+
+// Allocate a zeroed disk block: goal if it's free, or else
+// the first free block after it, so that a file growing one
+// block at a time gets consecutive blocks.
+// A block for file data (data != 0) is only zeroed in the
+// buffer cache, since writei() writes it to disk whole.
+// File data isn't logged, so data blocks are never ones
+// the log still has a copy of: installing that copy later
+// would overwrite the data.
+static uint
+balloc(uint dev, int data, uint goal)
+{
+  int b, bi, m;
+  struct buf *bp;
+
+  b = freealloc(dev, data, goal);
+  bp = bread(dev, BBLOCK(b, sb));
+  bi = b % BPB;
+  m = 1 << (bi % 8);
+  if(bp->data[bi/8] & m)
+    panic("balloc: free block in use");
+  bp->data[bi/8] |= m;  // Mark block in use.
+  log_write(bp);
+  brelse(bp);
+  if(data){
+    bp = bgetnew(dev, b);
+    memset(bp->data, 0, BSIZE);
+    brelse(bp);
+  } else {
+    bzero(dev, b);
+  }
+  return b;
 }
 
 // Free a disk block.
@@ -101,6 +279,18 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  log_free(dev, b, 1);
+}
+
+// Blocks start..start+len-1, freed by a transaction that
+// has now committed, may be allocated again.
+void
+bfree_commit(uint dev, uint start, uint len)
+{
+  uint b;
+
+  for(b = start; b < start + len; b++)
+    freeput(b);
 }
 
 // Inodes.
@@ -128,18 +318,19 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds or creates a cache entry and
+//   increments its ref; iput() decrements ref. An entry
+//   whose ref has fallen to zero stays cached, on a list of
+//   unused entries, until iget() finds it again or it is
+//   the least recently used of more than NINODE of them.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -163,56 +354,201 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// Cache entries are allocated from a slab cache as needed and
+// found through a hash table on (dev, inum). The icache.lock
+// spin-lock protects the hash table and the list of unused
+// entries. Since ip->ref says whether an entry is in use, and
+// ip->dev and ip->inum indicate which i-node an entry holds,
+// one must hold icache.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// Code that only reads an inode and its content can hold
+// ip->lock shared with other readers, using ilock_shared().
+
+#define NIHASH 31
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;    // where inodes come from
+  struct inode *hash[NIHASH];  // cached inodes, through hnext
+  struct inode unused;         // entries with ref 0, through prev/next,
+                               // most recently used first
+  int nunused;
 } icache;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode));
+  icache.unused.prev = &icache.unused;
+  icache.unused.next = &icache.unused;
+  dxcache = kmem_cache_create("dirindex", sizeof(struct dirindex));
+  dxentcache = kmem_cache_create("dxent", sizeof(struct dxent));
+  dcacheinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// Inode allocation.
+//
+// The inode bit map has a bit for each inode, set if the
+// inode is allocated; it changes together with the inode's
+// type, in the same transaction. ialloc() searches the map
+// from imap.next, which is kept at the lowest inode that may
+// be free, so it usually finds a free inode at the first bit
+// it looks at, in a block that's in the buffer cache.
+
+struct {
+  struct spinlock lock;
+  uint next;    // where ialloc() starts looking
+  uint nfree;   // number of free inodes
+} imap;
+
+// Read the inode bit map, count the free inodes, and
+// find the first one.
+static void
+imapinit(int dev)
+{
+  struct buf *bp;
+  uint inum, bi;
+
+  initlock(&imap.lock, "imap");
+  imap.next = 0;
+  imap.nfree = 0;
+  bp = 0;
+  for(inum = 1; inum < sb.ninodes; inum++){
+    bi = inum % BPB;
+    if(bp == 0 || bi == 0){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, IMBLOCK(inum, sb));
+    }
+    if(bp->data[bi/8] & (1 << (bi % 8)))
+      continue;
+    if(imap.next == 0)
+      imap.next = inum;
+    imap.nfree++;
+  }
+  if(bp)
+    brelse(bp);
+}
+
+// Find a free inode in the bit map, starting at inode start
+// and wrapping around, and mark it allocated.
+// The caller has reserved the inode, so there is one.
+static uint
+imaptake(uint dev, uint start)
+{
+  struct buf *bp;
+  uint inum, bi, n;
+
+  if(start < 1 || start >= sb.ninodes)
+    start = 1;
+  bp = 0;
+  inum = start;
+  for(n = 1; n < sb.ninodes; n++){
+    bi = inum % BPB;
+    if(bp == 0 || bi == 0 || inum == 1){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, IMBLOCK(inum, sb));
+    }
+    if((bp->data[bi/8] & (1 << (bi % 8))) == 0){
+      bp->data[bi/8] |= 1 << (bi % 8);
+      log_write(bp);
+      brelse(bp);
+      return inum;
+    }
+    if(++inum == sb.ninodes)
+      inum = 1;
+  }
+  panic("ialloc: inode map");
+}
+
+// Mark inode inum free in the bit map.
+static void
+ifree(uint dev, uint inum)
+{
+  struct buf *bp;
+  uint bi;
+
+  bp = bread(dev, IMBLOCK(inum, sb));
+  bi = inum % BPB;
+  if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+    panic("freeing free inode");
+  bp->data[bi/8] &= ~(1 << (bi % 8));
+  log_write(bp);
+  brelse(bp);
+
+  acquire(&imap.lock);
+  imap.nfree++;
+  if(inum < imap.next)
+    imap.next = inum;
+  release(&imap.lock);
+}
+
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  uint inum, start;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
-    brelse(bp);
-  }
-  panic("ialloc: no inodes");
+  // reserve an inode, so that racing callers can't
+  // both count on the last one.
+  acquire(&imap.lock);
+  if(imap.nfree == 0)
+    panic("ialloc: no inodes");
+  imap.nfree--;
+  start = imap.next;
+  release(&imap.lock);
+
+  inum = imaptake(dev, start);
+
+  // if a racing ialloc() or ifree() moved the
+  // hint, leave it alone; it's still a good place to look.
+  acquire(&imap.lock);
+  if(imap.next == start)
+    imap.next = inum + 1;
+  release(&imap.lock);
+
+  bp = bread(dev, IBLOCK(inum, sb));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: free inode in use");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
+}
+
+// Report the size and free space of the file system
+// on device dev.
+void
+fsstat(uint dev, struct statfs *st)
+{
+  int i;
+
+  st->bsize = BSIZE;
+  st->nblocks = sb.nblocks;
+  st->ninodes = sb.ninodes - 1;  // inode 0 isn't used
+
+  acquire(&freemap.lock);
+  st->bfree = 0;
+  for(i = 0; i < freemap.n; i++)
+    st->bfree += freemap.ext[i].len;
+  release(&freemap.lock);
+
+  acquire(&imap.lock);
+  st->ifree = imap.nfree;
+  release(&imap.lock);
 }
 
 // Copy a modified in-memory inode to disk.
@@ -232,42 +568,124 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->ext, ip->ext, sizeof(ip->ext));
+  dip->spill = ip->spill;
   log_write(bp);
   brelse(bp);
 }
 
+static struct inode**
+ichain(uint dev, uint inum)
+{
+  return &icache.hash[(dev + inum) % NIHASH];
+}
+
+// Find the cache entry for inode inum on device dev, or 0.
+// Caller must hold icache.lock.
+static struct inode*
+ifind(uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = *ichain(dev, inum); ip; ip = ip->hnext)
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+  return 0;
+}
+
+// Allocate an empty cache entry for inode inum on device
+// dev and put it in the hash table. Returns 0 if out of memory.
+// Caller must hold icache.lock.
+static struct inode*
+inew(uint dev, uint inum)
+{
+  struct inode *ip, **pp;
+
+  if((ip = kmem_cache_alloc(icache.cache)) == 0)
+    return 0;
+  // inodes come and go, so their locks aren't
+  // registered with initlock(); see spinlock.c.
+  memset(ip, 0, sizeof(*ip));
+  ip->lock.name = "inode";
+  ip->hintlock.name = "inode hints";
+  ip->dev = dev;
+  ip->inum = inum;
+  pp = ichain(dev, inum);
+  ip->hnext = *pp;
+  *pp = ip;
+  return ip;
+}
+
+// Put ip, which has no references, at the front of the
+// list of unused entries.
+// Caller must hold icache.lock.
+static void
+iunused(struct inode *ip)
+{
+  ip->next = icache.unused.next;
+  ip->prev = &icache.unused;
+  icache.unused.next->prev = ip;
+  icache.unused.next = ip;
+  icache.nunused++;
+}
+
+// Take ip off the list of unused entries.
+// Caller must hold icache.lock.
+static void
+iused(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  icache.nunused--;
+}
+
+// Drop entry ip, which has no references, from the cache.
+// Caller must hold icache.lock.
+static void
+ievict(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = ichain(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+    ;
+  *pp = ip->hnext;
+  dxfree(ip);
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&icache.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  if((ip = ifind(dev, inum)) != 0){
+    if(ip->ref++ == 0)
+      iused(ip);
+    release(&icache.lock);
+    return ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
-  ip->dev = dev;
-  ip->inum = inum;
+  // Make a new cache entry, or if there's no memory,
+  // recycle the least recently used unused one.
+  if((ip = inew(dev, inum)) == 0){
+    if(icache.nunused == 0)
+      panic("iget: no inodes");
+    ip = icache.unused.prev;
+    iused(ip);
+    ievict(ip);
+    ip->dev = dev;
+    ip->inum = inum;
+    ip->valid = 0;
+    pp = ichain(dev, inum);
+    ip->hnext = *pp;
+    *pp = ip;
+  }
   ip->ref = 1;
-  ip->valid = 0;
   release(&icache.lock);
 
   return ip;
@@ -284,6 +702,59 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Copy the on-disk inode dip into ip and mark it valid.
+// Caller must hold ip->lock.
+static void
+iload(struct inode *ip, struct dinode *dip)
+{
+  ip->type = dip->type;
+  ip->major = dip->major;
+  ip->minor = dip->minor;
+  ip->nlink = dip->nlink;
+  ip->size = dip->size;
+  memmove(ip->ext, dip->ext, sizeof(ip->ext));
+  ip->spill = dip->spill;
+  ip->xidx = ip->xbn = 0;
+  ip->ranext = ip->rawin = ip->raend = 0;
+  ip->valid = 1;
+}
+
+// Fill in the other inodes in inode block bp, just read for
+// ip, so that locking them later won't read the block again:
+// cached inodes that aren't valid yet, if their locks are
+// free, and allocated inodes that aren't cached, as unused
+// entries, while there's room for them.
+static void
+iprefetch(struct inode *ip, struct buf *bp)
+{
+  struct inode *np;
+  struct dinode *dip;
+  uint inum, first;
+
+  first = ip->inum - ip->inum%IPB;
+  acquire(&icache.lock);
+  for(inum = first; inum < first + IPB && inum < sb.ninodes; inum++){
+    if(inum == 0 || inum == ip->inum)
+      continue;
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if(dip->type == 0)
+      continue;
+    if((np = ifind(ip->dev, inum)) != 0){
+      // don't wait: whoever holds it will read it.
+      if(np->valid == 0 && tryacquiresleep(&np->lock)){
+        if(np->valid == 0)
+          iload(np, dip);
+        releasesleep(&np->lock);
+      }
+    } else if(icache.nunused < NINODE && (np = inew(ip->dev, inum)) != 0){
+      // no one else can have it yet.
+      iload(np, dip);
+      iunused(np);
+    }
+  }
+  release(&icache.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -300,14 +771,9 @@ ilock(struct inode *ip)
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
-    ip->type = dip->type;
-    ip->major = dip->major;
-    ip->minor = dip->minor;
-    ip->nlink = dip->nlink;
-    ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    iload(ip, dip);
+    iprefetch(ip, bp);
     brelse(bp);
-    ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
   }
@@ -323,9 +789,40 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Lock the given inode for reading, shared with other
+// readers. The caller may look at the inode and read its
+// content with readi(), but not change them.
+// Reads the inode from disk if necessary.
+void
+ilock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilock_shared");
+
+  acquiresleep_shared(&ip->lock);
+  while(ip->valid == 0){
+    // reading it in needs the lock to ourselves.
+    releasesleep_shared(&ip->lock);
+    ilock(ip);
+    iunlock(ip);
+    acquiresleep_shared(&ip->lock);
+  }
+}
+
+// Unlock an inode locked with ilock_shared().
+void
+iunlock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlock_shared");
+
+  releasesleep_shared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry
+// goes on the list of unused entries, and the least recently
+// used one is freed if there are too many.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -345,8 +842,12 @@ iput(struct inode *ip)
     release(&icache.lock);
 
     itrunc(ip);
+    dxfree(ip);
+    if(ip->type == T_DIR)
+      dpurge(ip->dev, ip->inum);
     ip->type = 0;
     iupdate(ip);
+    ifree(ip->dev, ip->inum);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
@@ -354,7 +855,22 @@ iput(struct inode *ip)
     acquire(&icache.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    if(ip->valid){
+      // keep it cached, in case it's used again soon,
+      // and free the least recently used unused one instead
+      // if there are too many.
+      iunused(ip);
+      if(icache.nunused <= NINODE){
+        release(&icache.lock);
+        return;
+      }
+      ip = icache.unused.prev;
+      iused(ip);
+    }
+    ievict(ip);
+    kmem_cache_free(icache.cache, ip);
+  }
   release(&icache.lock);
 }
 
@@ -369,40 +885,115 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// in blocks on the disk, in runs of consecutive blocks
+// called extents. The first NEXTENT extents are listed in
+// ip->ext[], the next NSPILL in block ip->spill. An extent
+// with length 0 ends the list.
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
-static uint
-bmap(struct inode *ip, uint bn)
+// Copy extent i of ip to *e.
+static void
+getext(struct inode *ip, uint i, struct extent *e)
 {
-  uint addr, *a;
   struct buf *bp;
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
+  if(i < NEXTENT){
+    *e = ip->ext[i];
+  } else if(ip->spill == 0){
+    e->start = e->len = 0;
+  } else {
+    bp = bread(ip->dev, ip->spill);
+    *e = ((struct extent*)bp->data)[i - NEXTENT];
+    brelse(bp);
   }
-  bn -= NDIRECT;
+}
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+// Set extent i of ip to *e, allocating the spill block if
+// necessary. The caller must iupdate() ip.
+static void
+putext(struct inode *ip, uint i, struct extent *e)
+{
+  struct buf *bp;
+
+  if(i < NEXTENT){
+    ip->ext[i] = *e;
+    return;
   }
+  if(ip->spill == 0)
+    ip->spill = balloc(ip->dev, 0, 0);
+  bp = bread(ip->dev, ip->spill);
+  ((struct extent*)bp->data)[i - NEXTENT] = *e;
+  log_write(bp);
+  brelse(bp);
+}
 
-  panic("bmap: out of range");
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one. Files only
+// grow at the end, so bn is then the block after the last
+// extent, and the new block extends the last extent if it
+// can. Returns 0 if ip has no room for another extent.
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  struct extent e;
+  uint i, lbn, addr;
+
+  // start at the extent found last time, which is where a
+  // sequential read or write will find the next block.
+  i = 0;
+  lbn = 0;
+  acquire(&ip->hintlock);
+  if(bn >= ip->xbn){
+    i = ip->xidx;
+    lbn = ip->xbn;
+  }
+  release(&ip->hintlock);
+  for(; i < NEXTENT + NSPILL; i++){
+    getext(ip, i, &e);
+    if(e.len == 0)
+      break;
+    if(bn < lbn + e.len){
+      acquire(&ip->hintlock);
+      ip->xidx = i;
+      ip->xbn = lbn;
+      release(&ip->hintlock);
+      return e.start + (bn - lbn);
+    }
+    lbn += e.len;
+  }
+  if(bn != lbn)
+    panic("bmap: hole");
+
+  if(i == 0){
+    // start a file in its inode's share of the data blocks,
+    // so that files written at the same time don't end up
+    // with their blocks interleaved.
+    addr = balloc(ip->dev, ip->type == T_FILE,
+                  sb.size - sb.nblocks + (uint64)ip->inum * sb.nblocks / sb.ninodes);
+  } else {
+    getext(ip, i-1, &e);
+    addr = balloc(ip->dev, ip->type == T_FILE, e.start + e.len);
+    if(addr == e.start + e.len){
+      e.len++;
+      putext(ip, i-1, &e);
+      acquire(&ip->hintlock);
+      ip->xidx = i-1;
+      ip->xbn = lbn - (e.len - 1);
+      release(&ip->hintlock);
+      return addr;
+    }
+  }
+  if(i == NEXTENT + NSPILL){
+    bfree(ip->dev, addr);
+    return 0;
+  }
+  e.start = addr;
+  e.len = 1;
+  putext(ip, i, &e);
+  acquire(&ip->hintlock);
+  ip->xidx = i;
+  ip->xbn = lbn;
+  release(&ip->hintlock);
+  return addr;
 }
 
 // Truncate inode (discard contents).
@@ -413,35 +1004,33 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  struct extent e;
+  uint i, b;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
-  }
+  pcache_inval(ip);
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+  for(i = 0; i < NEXTENT + NSPILL; i++){
+    getext(ip, i, &e);
+    if(e.len == 0)
+      break;
+    for(b = e.start; b < e.start + e.len; b++)
+      bfree(ip->dev, b);
+  }
+  memset(ip->ext, 0, sizeof(ip->ext));
+  if(ip->spill){
+    bfree(ip->dev, ip->spill);
+    ip->spill = 0;
   }
+  acquire(&ip->hintlock);
+  ip->xidx = ip->xbn = 0;
+  release(&ip->hintlock);
 
   ip->size = 0;
   iupdate(ip);
 }
 
 // Copy stat information from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, perhaps shared.
 void
 stati(struct inode *ip, struct stat *st)
 {
@@ -452,20 +1041,101 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Sequential read-ahead.
+// A read that starts where the previous read of the inode
+// ended turns on read-ahead: blocks past the end of the read,
+// up to a window, are fetched into the buffer cache. The window
+// starts at RAMIN blocks and doubles with each sequential read,
+// up to RAMAX. A read anywhere else turns read-ahead off.
+#define RAMIN 4
+#define RAMAX 32
+
+// Note a read of blocks first..last of ip, and read ahead
+// if the inode is being read sequentially.
+// Caller must hold ip->lock, perhaps shared.
+static void
+readahead(struct inode *ip, uint first, uint last)
+{
+  uint b, end, nblk, blocks[MAXIOBLOCKS];
+  int n;
+
+  acquire(&ip->hintlock);
+  if(first == ip->ranext){
+    ip->rawin = ip->rawin ? min(2*ip->rawin, RAMAX) : RAMIN;
+  } else if(first + 1 != ip->ranext){
+    // not sequential (a read that starts in the block
+    // the last one ended in still counts).
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = last + 1;
+  if(ip->rawin == 0){
+    release(&ip->hintlock);
+    return;
+  }
+
+  // the blocks of the read itself, after the first, and
+  // the window past it, that haven't been fetched yet.
+  nblk = (ip->size + BSIZE - 1) / BSIZE;
+  end = min(last + 1 + ip->rawin, nblk);
+  b = ip->raend > first + 1 ? ip->raend : first + 1;
+  if(end > ip->raend)
+    ip->raend = end;
+  release(&ip->hintlock);
+
+  n = 0;
+  for(; b < end; b++){
+    blocks[n++] = bmap(ip, b);
+    if(n == MAXIOBLOCKS){
+      breadaheadv(ip->dev, blocks, n);
+      n = 0;
+    }
+  }
+  if(n > 0)
+    breadaheadv(ip->dev, blocks, n);
+}
+
+// Put in blocks[] the inode blocks of the entries in bytes
+// off..off+n of directory block data, without duplicates,
+// up to MAXIOBLOCKS of them. Returns how many there are.
+static int
+direntblocks(uchar *data, uint off, uint n, uint *blocks)
+{
+  struct dirent *de;
+  uint b;
+  int i, nb;
+
+  nb = 0;
+  de = (struct dirent*)(data + off - off % sizeof(*de));
+  for(; (uchar*)de < data + off + n && nb < MAXIOBLOCKS; de++){
+    if(de->inum == 0 || de->inum >= sb.ninodes)
+      continue;
+    b = IBLOCK(de->inum, sb);
+    for(i = 0; i < nb && blocks[i] != b; i++)
+      ;
+    if(i == nb)
+      blocks[nb++] = b;
+  }
+  return nb;
+}
+
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, perhaps shared.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, blocks[MAXIOBLOCKS];
   struct buf *bp;
+  int nb;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off/BSIZE, (off + n - 1)/BSIZE);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -474,7 +1144,14 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
       brelse(bp);
       break;
     }
+    nb = 0;
+    if(ip->type == T_DIR && user_dst)
+      nb = direntblocks(bp->data, off % BSIZE, m, blocks);
     brelse(bp);
+    // a program reading a directory, like ls, is likely to
+    // look at the entries' inodes next: start reading them.
+    if(nb > 0)
+      breadaheadv(ip->dev, blocks, nb);
   }
   return n;
 }
@@ -483,26 +1160,55 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
 // otherwise, src is a kernel address.
+//
+// The data of a regular file isn't logged: it's written
+// to disk before writei() returns, and so before the
+// transaction that makes it part of the file commits.
+// Only directories and other metadata go through the log.
+// A data block that the log still has a copy of is logged
+// too, so the copy can't overwrite it later; balloc()
+// makes sure that's rare.
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, addr;
+  struct buf *bp, *bs[MAXIOBLOCKS];
+  int nb;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  nb = 0;
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if((addr = bmap(ip, off/BSIZE)) == 0)
+      break;  // out of extents
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
-    log_write(bp);
-    brelse(bp);
+    pcache_update(ip, off, (char*)bp->data + (off % BSIZE), m);
+    if(ip->type != T_FILE || bp->pins > 0){
+      log_write(bp);
+      brelse(bp);
+      continue;
+    }
+    // write data blocks in batches, so that
+    // adjacent ones go in one disk request.
+    bs[nb++] = bp;
+    if(nb == MAXIOBLOCKS){
+      bwritev(bs, nb);
+      while(nb > 0)
+        brelse(bs[--nb]);
+    }
+  }
+  if(nb > 0){
+    bwritev(bs, nb);
+    while(nb > 0)
+      brelse(bs[--nb]);
   }
 
   if(n > 0){
@@ -510,11 +1216,11 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       ip->size = off;
     // write the i-node back to disk even if the size didn't change
     // because the loop above might have called bmap() and added a new
-    // block to ip->addrs[].
+    // block to ip->ext[].
     iupdate(ip);
   }
 
-  return n;
+  return tot;
 }
 
 // Directories
@@ -525,6 +1231,296 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory index.
+//
+// The first lookup in a directory reads all of it into an
+// in-memory hash table of its entries, keyed by name, in
+// dp->dx. After that, dirlookup() and dirlink() find a name
+// or an empty entry without reading the directory: the
+// empty entries are kept on a list, which dirlink() takes
+// from and dirunlink() adds to. The index lasts until the
+// inode leaves the inode cache, and is protected by dp->lock.
+// If there's no memory for an index, directories are
+// searched one entry at a time, as before.
+
+#define NDXHASH 16  // initial buckets; a power of two
+
+static uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Put in-use entry e in dx's hash table, doubling the
+// table first if it's as full as it should get.
+static void
+dxinsert(struct dirindex *dx, struct dxent *e)
+{
+  struct dxent **tab, *f;
+  uint i, h;
+
+  if(dx->n >= dx->nhash && (tab = bd_malloc(2*dx->nhash*sizeof(*tab))) != 0){
+    memset(tab, 0, 2*dx->nhash*sizeof(*tab));
+    for(i = 0; i < dx->nhash; i++){
+      while((f = dx->hash[i]) != 0){
+        dx->hash[i] = f->next;
+        h = dxhash(f->name) & (2*dx->nhash - 1);
+        f->next = tab[h];
+        tab[h] = f;
+      }
+    }
+    bd_free(dx->hash);
+    dx->hash = tab;
+    dx->nhash *= 2;
+  }
+  h = dxhash(e->name) & (dx->nhash - 1);
+  e->next = dx->hash[h];
+  dx->hash[h] = e;
+  dx->n++;
+}
+
+// Add the dirent de, at offset off, to dx.
+// Returns -1 if out of memory.
+static int
+dxadd(struct dirindex *dx, struct dirent *de, uint off)
+{
+  struct dxent *e;
+
+  if((e = kmem_cache_alloc(dxentcache)) == 0)
+    return -1;
+  e->off = off;
+  e->inum = de->inum;
+  memmove(e->name, de->name, DIRSIZ);
+  if(de->inum == 0){
+    e->next = dx->free;
+    dx->free = e;
+  } else {
+    dxinsert(dx, e);
+  }
+  return 0;
+}
+
+// Free ip's directory index, if it has one.
+static void
+dxfree(struct inode *ip)
+{
+  struct dirindex *dx = ip->dx;
+  struct dxent *e;
+  uint i;
+
+  if(dx == 0)
+    return;
+  ip->dx = 0;
+  for(i = 0; i < dx->nhash; i++){
+    while((e = dx->hash[i]) != 0){
+      dx->hash[i] = e->next;
+      kmem_cache_free(dxentcache, e);
+    }
+  }
+  while((e = dx->free) != 0){
+    dx->free = e->next;
+    kmem_cache_free(dxentcache, e);
+  }
+  bd_free(dx->hash);
+  kmem_cache_free(dxcache, dx);
+}
+
+// Return the index of directory dp, reading the directory
+// to build it if there isn't one yet.
+// Returns 0 if there's no memory for it.
+// Caller must hold dp->lock.
+static struct dirindex*
+dxget(struct inode *dp)
+{
+  struct dirindex *dx;
+  struct buf *bp;
+  uint off;
+
+  if(dp->dx)
+    return dp->dx;
+  if((dx = kmem_cache_alloc(dxcache)) == 0)
+    return 0;
+  if((dx->hash = bd_malloc(NDXHASH*sizeof(*dx->hash))) == 0){
+    kmem_cache_free(dxcache, dx);
+    return 0;
+  }
+  memset(dx->hash, 0, NDXHASH*sizeof(*dx->hash));
+  dx->nhash = NDXHASH;
+  dx->n = 0;
+  dx->free = 0;
+  dp->dx = dx;
+
+  bp = 0;
+  for(off = 0; off < dp->size; off += sizeof(struct dirent)){
+    if(bp == 0 || off % BSIZE == 0){
+      if(bp)
+        brelse(bp);
+      bp = bread(dp->dev, bmap(dp, off / BSIZE));
+    }
+    if(dxadd(dx, (struct dirent*)(bp->data + off % BSIZE), off) < 0){
+      brelse(bp);
+      dxfree(dp);
+      return 0;
+    }
+  }
+  if(bp)
+    brelse(bp);
+  return dx;
+}
+
+// Directory entry cache.
+//
+// namex() looks up each path element in a cache of recent
+// directory lookups before it locks the directory to search
+// it. An entry maps (dev, directory inode, name) to the inode
+// number of the name in that directory, or to 0 if the name
+// isn't there, so that lookups of missing files hit too.
+//
+// Entries are only added or changed by code that holds the
+// directory's lock: dirlookup() records what it found,
+// dirlink() and dirunlink() record the names they add and
+// remove, and freeing a directory's inode drops its entries.
+// So an entry always agrees with the directory.
+//
+// There are NDENTRY entries, in NDHASH hash chains and on a
+// list from most to least recently used, which is the order
+// they're replaced in. dcache.lock protects all of it.
+
+#define NDHASH 31
+
+struct dentry {
+  struct list lru;      // must be first
+  struct dentry *next;  // hash chain
+  uint dev;
+  uint dir;             // directory inode; 0 if unused
+  uint inum;            // inode of name, 0 if it doesn't exist
+  char name[DIRSIZ];
+};
+
+struct {
+  struct spinlock lock;
+  struct list lru;      // most recently used first
+  struct dentry *hash[NDHASH];
+  struct dentry dentry[NDENTRY];
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  lst_init(&dcache.lru);
+  for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++)
+    lst_push(&dcache.lru, d);
+}
+
+static struct dentry**
+dchain(uint dev, uint dir, char *name)
+{
+  return &dcache.hash[(dxhash(name) ^ dir*2654435761U ^ dev) % NDHASH];
+}
+
+// Find the entry for name in directory dir.
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dchain(dev, dir, name); d; d = d->next)
+    if(d->dev == dev && d->dir == dir && namecmp(name, d->name) == 0)
+      return d;
+  return 0;
+}
+
+// Take d off its hash chain and mark it unused.
+// Caller must hold dcache.lock.
+static void
+dremove(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dchain(d->dev, d->dir, d->name); *pp != d; pp = &(*pp)->next)
+    ;
+  *pp = d->next;
+  d->dir = 0;
+}
+
+// Record that name in directory dp is inode inum,
+// or isn't there if inum is 0.
+// Caller must hold dp->lock.
+static void
+dset(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d, **pp;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    // recycle the least recently used entry.
+    d = (struct dentry*)dcache.lru.prev;
+    if(d->dir)
+      dremove(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    pp = dchain(d->dev, d->dir, d->name);
+    d->next = *pp;
+    *pp = d;
+  }
+  d->inum = inum;
+  lst_remove(&d->lru);
+  lst_push(&dcache.lru, d);
+  release(&dcache.lock);
+}
+
+// Look up name in directory dp in the cache, without
+// locking dp. Returns 0 if it isn't cached. Otherwise returns
+// 1 and sets *ipp to the inode, referenced, or to 0 if the
+// name doesn't exist.
+static int
+dlookup(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  lst_remove(&d->lru);
+  lst_push(&dcache.lru, d);
+  // take the reference before releasing the lock, so that
+  // the inode can't be unlinked and freed in between.
+  *ipp = d->inum ? iget(dp->dev, d->inum) : 0;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Drop the entries of directory dir, which is being freed.
+static void
+dpurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++){
+    if(d->dir == dir && d->dev == dev){
+      dremove(d);
+      // move it to the end, to be recycled first.
+      lst_remove(&d->lru);
+      lst_push(dcache.lru.prev, d);
+    }
+  }
+  release(&dcache.lock);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -532,10 +1528,25 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
   struct dirent de;
+  struct dirindex *dx;
+  struct dxent *e;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if((dx = dxget(dp)) != 0){
+    for(e = dx->hash[dxhash(name) & (dx->nhash - 1)]; e; e = e->next){
+      if(namecmp(name, e->name) == 0){
+        if(poff)
+          *poff = e->off;
+        dset(dp, name, e->inum);
+        return iget(dp->dev, e->inum);
+      }
+    }
+    dset(dp, name, 0);
+    return 0;
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -546,10 +1557,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dset(dp, name, inum);
       return iget(dp->dev, inum);
     }
   }
 
+  dset(dp, name, 0);
   return 0;
 }
 
@@ -557,9 +1570,11 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  uint off;
   struct dirent de;
   struct inode *ip;
+  struct dirindex *dx;
+  struct dxent *e;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -568,21 +1583,68 @@ dirlink(struct inode *dp, char *name, uint inum)
   }
 
   // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  e = 0;
+  if((dx = dxget(dp)) != 0){
+    if((e = dx->free) != 0){
+      dx->free = e->next;
+      off = e->off;
+    } else {
+      off = dp->size;
+    }
+  } else {
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        break;
+    }
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
-
+  dset(dp, name, inum);
+
+  if(e){
+    e->inum = inum;
+    memmove(e->name, de.name, DIRSIZ);
+    dxinsert(dx, e);
+  } else if(dx && dxadd(dx, &de, off) < 0){
+    dxfree(dp);
+  }
   return 0;
 }
 
+// Remove the entry for name, which is at byte offset off,
+// from the directory dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirent de;
+  struct dirindex *dx;
+  struct dxent **pp, *e;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink");
+  dset(dp, name, 0);
+
+  if((dx = dp->dx) == 0)
+    return;
+  for(pp = &dx->hash[dxhash(name) & (dx->nhash - 1)]; (e = *pp) != 0; pp = &e->next){
+    if(e->off == off){
+      *pp = e->next;
+      dx->n--;
+      e->inum = 0;
+      e->next = dx->free;
+      dx->free = e;
+      return;
+    }
+  }
+  panic("dirunlink: not in index");
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -630,6 +1692,7 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  int shared, stop;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
@@ -637,21 +1700,42 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
-    if(ip->type != T_DIR){
-      iunlockput(ip);
-      return 0;
+    if(!(nameiparent && *path == '\0') && dlookup(ip, name, &next)){
+      // a cached lookup: only directories have entries,
+      // so ip is one.
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
     }
-    if(nameiparent && *path == '\0'){
-      // Stop one level early.
+    // a lookup only reads the directory, so lookups in
+    // the same directory can go on at the same time.
+    ilock_shared(ip);
+    shared = 1;
+    if(ip->type == T_DIR && ip->dx == 0){
+      // except the first, which builds its index.
+      iunlock_shared(ip);
+      ilock(ip);
+      shared = 0;
+    }
+    next = 0;
+    stop = 0;
+    if(ip->type == T_DIR){
+      if(nameiparent && *path == '\0')
+        stop = 1;  // Stop one level early.
+      else
+        next = dirlookup(ip, name, 0);
+    }
+    if(shared)
+      iunlock_shared(ip);
+    else
       iunlock(ip);
+    if(stop)
       return ip;
-    }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
@@ -3,11 +3,13 @@
 
 
 #define ROOTINO  1   // root i-number
-#define BSIZE 1024  // block size
+#ifndef BSIZE
+#define BSIZE 4096  // block size; the Makefile may set it
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                      inode bit map | free bit map | data blocks]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -19,14 +21,48 @@ struct superblock {
   uint nlog;         // Number of log blocks
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
+  uint imapstart;    // Block number of first inode bit map block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes); must be BSIZE
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+// The log starts with an anchor block, followed by a
+// circular buffer of transactions. See log.c.
+#define LOGMAGIC 0x10203041
+
+// The anchor says where recovery starts.
+struct loganchor {
+  uint magic;           // Must be LOGMAGIC
+  uint seq;             // Sequence number of the first transaction
+  uint tail;            // Block of its header in the circular buffer
+};
+
+// Each transaction starts with a header block. A transaction's
+// header and logged blocks are written together, so after a
+// crash the header only counts if its checksum matches the
+// blocks in the log.
+#define LOGHDRN ((BSIZE - 4*sizeof(uint)) / sizeof(int))
+struct logheader {
+  uint magic;           // Must be LOGMAGIC
+  uint seq;             // Sequence number of the transaction
+  uint cksum;           // Checksum of the header and logged blocks
+  int n;                // Number of logged blocks
+  int block[LOGHDRN];   // Their home block numbers
+};
+
+// A file's data is a list of extents, each a run of
+// consecutive disk blocks, in file order. The first NEXTENT
+// are in the inode, the rest in the inode's spill block.
+struct extent {
+  uint start;           // First disk block
+  uint len;             // Number of blocks; 0 ends the list
+};
+
+#define NEXTENT 6
+#define NSPILL (BSIZE / sizeof(struct extent))
+#define MAXFILE 2048    // Max file size (blocks)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +71,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  struct extent ext[NEXTENT];  // Data block extents
+  uint spill;           // Block of more extents, or 0
 };
 
 // Inodes per block.
@@ -50,6 +87,9 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
+// Block of inode map containing bit for inode i
+#define IMBLOCK(i, sb) ((i)/BPB + sb.imapstart)
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
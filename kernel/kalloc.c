@@ -1,6 +1,26 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU has its own free list and lock, so that kalloc()
+// and kfree() on different harts don't contend. A CPU whose
+// list runs dry steals a batch of pages from another CPU.
+//
+// When memory runs out, kalloc() asks the buffer cache to
+// give some back; see bcache_reclaim() in bio.c.
+//
+// Each CPU also keeps a small pool of pages that are already
+// zero, refilled by the scheduler when the hart is idle, so
+// that kalloc_zeroed() usually doesn't have to clear a page.
+//
+// Every physical page has a reference count, so that a page
+// can be shared, e.g. by copy-on-write fork(). kalloc() sets
+// the count to one, kincref() adds a reference, and kfree()
+// only puts the page back on a free list when the last
+// reference is dropped.
+//
+// Build with -DKALLOC_JUNK to fill pages with junk on kalloc()
+// and kfree(), to catch uses of uninitialized or freed memory.
 
 #include "types.h"
 #include "param.h"
@@ -14,20 +34,41 @@ void freerange(void *pa_start, void *pa_end);
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// how many pages a CPU takes from another CPU's
+// free list when its own list is empty.
+#define NSTEAL 32
+
+// how many pre-zeroed pages each CPU tries to keep.
+#define NZERO  64
+
 struct run {
   struct run *next;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+  struct run *zerolist;  // pages known to be all zero
+  int nzero;
+};
+
+struct kmem kmems[NCPU];
+
+// reference counts of physical pages, indexed by
+// (pa - KERNBASE) / PGSIZE. updated with atomic operations.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+int kref[(PHYSTOP - KERNBASE) / PGSIZE];
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  char *heap = (char*)PGROUNDUP((uint64)end);
+
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmems[i].lock, "kmem");
+  bd_init(heap, heap + KHEAPSIZE);
+  freerange(heap + KHEAPSIZE, (void*)PHYSTOP);
 }
 
 void
@@ -35,31 +76,156 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kref[PA2REF(p)] = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// When the last reference is gone, the page goes on the
+// current CPU's free list.
 void
 kfree(void *pa)
 {
   struct run *r;
+  struct kmem *km;
+  int n;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end + KHEAPSIZE || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  n = __sync_sub_and_fetch(&kref[PA2REF(pa)], 1);
+  if(n < 0)
+    panic("kfree: refcount");
+  if(n > 0)
+    return;
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  km = &kmems[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  release(&km->lock);
+  pop_off();
+}
+
+// Move up to NSTEAL pages from another CPU's free list
+// to the free list of CPU id. Takes the fullest victim's
+// pages, so that repeated steals spread out.
+// Returns the number of pages moved, 0 only if no other
+// CPU has any.
+// Must be called with interrupts disabled.
+static int
+steal(int id)
+{
+  struct kmem *km = &kmems[id];
+  struct kmem *victim;
+  struct run *first, *last;
+  int i, n, best, tried;
+
+  tried = 1 << id;
+  for(;;){
+    // pick the CPU with the most free pages. nfree is
+    // read without the lock; it's only a hint.
+    best = -1;
+    for(i = 0; i < NCPU; i++){
+      if((tried & (1 << i)) || kmems[i].nfree == 0)
+        continue;
+      if(best < 0 || kmems[i].nfree > kmems[best].nfree)
+        best = i;
+    }
+    if(best < 0)
+      return 0;
+    tried |= 1 << best;
+
+    // detach a run of pages from the victim, holding
+    // only the victim's lock.
+    victim = &kmems[best];
+    acquire(&victim->lock);
+    first = victim->freelist;
+    last = 0;
+    n = 0;
+    for(struct run *r = first; r && n < NSTEAL; r = r->next){
+      last = r;
+      n++;
+    }
+    if(n > 0){
+      victim->freelist = last->next;
+      victim->nfree -= n;
+    }
+    release(&victim->lock);
+
+    if(n > 0)
+      break;
+    // another CPU emptied it first; try the next one.
+  }
+
+  acquire(&km->lock);
+  last->next = km->freelist;
+  km->freelist = first;
+  km->nfree += n;
+  release(&km->lock);
+  return n;
+}
+
+// Take a page from some CPU's pool of zeroed pages,
+// starting with CPU id. Returns 0 if all pools are empty.
+// Must be called with interrupts disabled.
+static struct run*
+takezero(int id)
+{
+  struct kmem *km;
+  struct run *r;
+
+  for(int i = 0; i < NCPU; i++){
+    km = &kmems[(id + i) % NCPU];
+    if(km->nzero == 0)
+      continue;
+    acquire(&km->lock);
+    r = km->zerolist;
+    if(r){
+      km->zerolist = r->next;
+      km->nzero--;
+    }
+    release(&km->lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
+// Pop a page from CPU id's free list, stealing from
+// other CPUs if the list is empty.
+// Must be called with interrupts disabled.
+static struct run*
+takefree(int id)
+{
+  struct kmem *km = &kmems[id];
+  struct run *r;
+
+  for(;;){
+    acquire(&km->lock);
+    r = km->freelist;
+    if(r){
+      km->freelist = r->next;
+      km->nfree--;
+    }
+    release(&km->lock);
+    if(r || steal(id) == 0)
+      return r;
+  }
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +235,98 @@ void *
 kalloc(void)
 {
   struct run *r;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  do {
+    push_off();
+    id = cpuid();
+    r = takefree(id);
+    if(r == 0)
+      r = takezero(id);  // use up zeroed pages
+    pop_off();
+  } while(r == 0 && bcache_reclaim());  // last resort: shrink the buffer cache
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
+  if(r == 0)
+    return 0;
+  kref[PA2REF(r)] = 1;
+#ifdef KALLOC_JUNK
+  memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
+
+// Allocate one 4096-byte page of physical memory
+// whose contents are all zero.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+  int id, zeroed;
+
+  do {
+    push_off();
+    id = cpuid();
+    zeroed = 1;
+    if((r = takezero(id)) == 0){
+      r = takefree(id);
+      zeroed = 0;
+    }
+    pop_off();
+  } while(r == 0 && bcache_reclaim());
+
+  if(r == 0)
+    return 0;
+  kref[PA2REF(r)] = 1;
+  if(zeroed)
+    r->next = 0;  // the only word of a pooled page that isn't zero
+  else
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Add a reference to the page at pa,
+// which must already have at least one.
+void
+kincref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end + KHEAPSIZE || (uint64)pa >= PHYSTOP)
+    panic("kincref");
+  if(__sync_fetch_and_add(&kref[PA2REF(pa)], 1) < 1)
+    panic("kincref: free page");
+}
+
+// Return the number of references to the page at pa.
+int
+krefcnt(void *pa)
+{
+  return kref[PA2REF(pa)];
+}
+
+// Zero one free page and add it to this CPU's zeroed pool,
+// if the pool is below its target. Called by an idle hart
+// from scheduler(), with interrupts disabled.
+// Returns 1 if a page was zeroed, 0 if there was nothing to do.
+int
+kzero_refill(void)
+{
+  struct kmem *km;
+  struct run *r;
+  int id;
+
+  id = cpuid();
+  km = &kmems[id];
+  if(km->nzero >= NZERO)
+    return 0;
+  if((r = takefree(id)) == 0)
+    return 0;
+
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&km->lock);
+  r->next = km->zerolist;
+  km->zerolist = r;
+  km->nzero++;
+  release(&km->lock);
+  return 1;
+}
@@ -10,31 +10,72 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. A transaction is only committed when there are
+// no FS system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
+// The log is double-buffered: while one transaction is being
+// written to disk, a second one accepts new FS system calls.
+// When the committing transaction is frozen, the contents of
+// its blocks are copied into the log's own buffers, so that
+// the next transaction can go on changing the cached blocks
+// while the commit writes the frozen copies. FS system calls
+// that finish while a commit is in progress are grouped into
+// the next commit, which the committer starts as soon as it's
+// done with the previous one.
+//
+// A commit only writes the transaction to the log. Its blocks
+// stay pinned in the buffer cache, which holds the latest
+// copy, until a checkpoint installs them at their home
+// locations. Checkpoints are done by a flusher thread, every
+// LOGFLUSHTICKS or when the log is half full, or by a commit
+// that finds the log full.
+//
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the open transaction commits.
+// The end_op() of the last system call in a transaction
+// returns once the transaction is in the log on disk.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
-
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
-struct logheader {
+//   anchor block, saying where the oldest transaction that
+//     isn't installed yet starts
+//   a circular buffer of transactions, each one:
+//     header block, containing a sequence number, a checksum,
+//       and block #s for block A, B, C, ...
+//     block A
+//     block B
+//     block C
+//     ...
+// A transaction's header and blocks are written to disk as
+// one batch, in no particular order. The checksum covers the
+// header and the logged blocks, so recovery can tell a
+// complete commit from one that was torn by a crash, and
+// from an older transaction whose blocks have since been
+// overwritten. Recovery replays transactions from the anchor
+// on, for as long as they have the next sequence number and
+// a good checksum. The anchor is moved past installed
+// transactions before their space is reused.
+// struct logheader and struct loganchor are in fs.h, since
+// mkfs writes the first anchor; in memory, struct logheader
+// also tracks the logged block#s before commit.
+//
+// Blocks freed by a transaction aren't reused until it has
+// committed (see log_free()), since a reused data block is
+// written home at once, and a crash before the commit would
+// leave the old metadata pointing at the new data.
+
+#define LOGFLUSHTICKS 30  // install committed transactions this often
+
+// A page of extents freed by a transaction.
+struct freed {
+  struct freed *next;
   int n;
-  int block[LOGSIZE];
+  struct extent ext[(PGSIZE - 2*sizeof(uint64)) / sizeof(struct extent)];
 };
 
 struct log {
@@ -42,72 +83,147 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // commit() or checkpoint() is writing the log.
+  int freezing;    // commit() is copying blocks; please wait.
+  uint seq;        // sequence number of the open transaction.
+  uint done;       // transactions before this one are on disk.
   int dev;
-  struct logheader lh;
+  int nring;       // blocks in the circular buffer
+  int tail;        // where the oldest transaction not installed starts
+  int used;        // blocks in use, from tail on
+  struct logheader lh;   // the open transaction
+  struct buf *pin[LOGSIZE];  // its pinned cache blocks
+  struct logheader clh;  // the committing transaction
+  struct buf *cpin[LOGSIZE];
+  int cpos;              // where it goes in the circular buffer
+  struct buf *lbuf[LOGSIZE]; // frozen copies of clh's blocks
+  struct buf *ring[LOGBLOCKS]; // the pinned cache block logged in
+                               // each block of the circular buffer
+  struct buf shadow[LOGSIZE]; // for writing logged copies home
+  struct freed *freed;   // blocks the open transaction freed
+  struct freed *cfreed;  // blocks the committing one freed
 };
 struct log log[NDISK];
 
 static void recover_from_log(int);
 static void commit(int);
+static void logflush(int);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE || LOGSIZE > LOGHDRN)
     panic("initlog: too big logheader");
+  if (sb->nlog > LOGBLOCKS || sb->nlog < LOGSIZE + 2)
+    panic("initlog: bad log size");
 
   initlock(&log[dev].lock, "log");
   log[dev].start = sb->logstart;
   log[dev].size = sb->nlog;
+  log[dev].nring = sb->nlog - 1;
   log[dev].dev = dev;
+  for (int i = 0; i < LOGSIZE; i++)
+    initsleeplock(&log[dev].shadow[i].lock, "shadow");
   recover_from_log(dev);
+  kthread("logflush", logflush, dev);
+}
+
+// Disk block number of block pos of the circular buffer.
+static uint
+ringblock(int dev, int pos)
+{
+  return log[dev].start + 1 + pos % log[dev].nring;
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home locations,
+// writing them all as one batch.
+// lbuf[i] holds the logged contents of block block[i].
 static void
-install_trans(int dev)
+install_trans(int dev, int *block, struct buf **lbuf, int n, int recovering)
 {
-  int tail;
+  struct buf *dbuf[LOGSIZE], *b;
+  int i, j;
+
+  if(recovering){
+    for (i = 0; i < n; i++) {
+      dbuf[i] = bgetnew(dev, block[i]); // dst
+      memmove(dbuf[i]->data, lbuf[i]->data, BSIZE);  // copy block to dst
+    }
+    bwritev(dbuf, n);  // write dsts to disk
+    for (i = 0; i < n; i++)
+      brelse(dbuf[i]);
+    return;
+  }
 
-  for (tail = 0; tail < log[dev].lh.n; tail++) {
-    struct buf *lbuf = bread(dev, log[dev].start+tail+1); // read log block
-    struct buf *dbuf = bread(dev, log[dev].lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  // the cached blocks may already hold changes made by
+  // later transactions, so write the logged copies,
+  // through shadow bufs that aren't in the cache. sort
+  // them by block number, so adjacent blocks are merged
+  // into one disk request.
+  for (i = 0; i < n; i++) {
+    b = &log[dev].shadow[i];
+    acquiresleep(&b->lock);
+    b->dev = dev;
+    b->blockno = block[i];
+    b->data = lbuf[i]->data;
+    for (j = i; j > 0 && dbuf[j-1]->blockno > b->blockno; j--)
+      dbuf[j] = dbuf[j-1];
+    dbuf[j] = b;
   }
+  bwritev(dbuf, n);
+  for (i = 0; i < n; i++)
+    releasesleep(&log[dev].shadow[i].lock);
 }
 
-// Read the log header from disk into the in-memory log header
-static void
-read_head(int dev)
+static uint
+fnv(uint h, uint *p, int n)
+{
+  for (int i = 0; i < n; i++)
+    h = (h ^ p[i]) * 16777619;
+  return h;
+}
+
+// Checksum of a transaction: of its header, except for
+// the checksum itself, and of its logged blocks lbuf[].
+static uint
+log_cksum(struct logheader *lh, struct buf **lbuf)
 {
-  struct buf *buf = bread(dev, log[dev].start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  uint h = 2166136261;  // FNV-1a, a word at a time
   int i;
-  log[dev].lh.n = lh->n;
-  for (i = 0; i < log[dev].lh.n; i++) {
-    log[dev].lh.block[i] = lh->block[i];
-  }
+
+  h = fnv(h, &lh->magic, 2);
+  h = fnv(h, (uint*)&lh->n, 1);
+  h = fnv(h, (uint*)lh->block, lh->n);
+  for (i = 0; i < lh->n; i++)
+    h = fnv(h, (uint*)lbuf[i]->data, BSIZE/sizeof(uint));
+  return h;
+}
+
+// Read the transaction header at block pos of the circular
+// buffer into lh. Returns 0 if the block doesn't hold a
+// plausible header.
+static int
+read_head(int dev, int pos, struct logheader *lh)
+{
+  struct buf *buf = bread(dev, ringblock(dev, pos));
+  memmove(lh, buf->data, sizeof(*lh));
   brelse(buf);
+  return lh->magic == LOGMAGIC && lh->n >= 0 &&
+         lh->n <= LOGSIZE && lh->n < log[dev].nring;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write the anchor: recovery is to start with transaction
+// seq, whose header is at block tail of the circular buffer.
 static void
-write_head(int dev)
+write_anchor(int dev, int tail, uint seq)
 {
-  struct buf *buf = bread(dev, log[dev].start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log[dev].lh.n;
-  for (i = 0; i < log[dev].lh.n; i++) {
-    hb->block[i] = log[dev].lh.block[i];
-  }
+  struct buf *buf = bgetnew(dev, log[dev].start);
+  struct loganchor *a = (struct loganchor *) (buf->data);
+
+  memset(buf->data, 0, BSIZE);
+  a->magic = LOGMAGIC;
+  a->seq = seq;
+  a->tail = tail;
   bwrite(buf);
   brelse(buf);
 }
@@ -115,10 +231,54 @@ write_head(int dev)
 static void
 recover_from_log(int dev)
 {
-  read_head(dev);
-  install_trans(dev); // if committed, copy from log to disk
-  log[dev].lh.n = 0;
-  write_head(dev); // clear the log
+  struct logheader *lh = &log[dev].clh;
+  struct loganchor *a;
+  struct buf *buf;
+  uint blocks[LOGSIZE];
+  uint seq;
+  int i, pos, used, ok;
+
+  buf = bread(dev, log[dev].start);
+  a = (struct loganchor *) (buf->data);
+  if (a->magic == LOGMAGIC && a->tail < log[dev].nring) {
+    pos = a->tail;
+    seq = a->seq;
+  } else {
+    pos = 0;
+    seq = 1;
+  }
+  brelse(buf);
+
+  // replay committed transactions, oldest first.
+  for (used = 0; ; used += lh->n + 1) {
+    if (!read_head(dev, pos, lh) || lh->seq != seq ||
+       used + lh->n + 1 > log[dev].nring)
+      break;
+    for (i = 0; i < lh->n; i++)
+      blocks[i] = ringblock(dev, pos+i+1);
+    breadaheadv(dev, blocks, lh->n);  // start all the log block reads
+    for (i = 0; i < lh->n; i++)
+      log[dev].lbuf[i] = bread(dev, blocks[i]); // read log block
+    ok = lh->cksum == log_cksum(lh, log[dev].lbuf);  // committed?
+    if (ok)
+      install_trans(dev, lh->block, log[dev].lbuf, lh->n, 1); // copy from log to disk
+    for (i = 0; i < lh->n; i++)
+      brelse(log[dev].lbuf[i]);
+    if (!ok)
+      break;
+    pos = (pos + lh->n + 1) % log[dev].nring;
+    seq++;
+  }
+  lh->n = 0;
+
+  // the log is empty now. go on numbering transactions
+  // after the ones on disk, so that stale headers are
+  // never taken for new ones.
+  write_anchor(dev, pos, seq);
+  log[dev].tail = pos;
+  log[dev].used = 0;
+  log[dev].seq = seq;
+  log[dev].done = seq;
 }
 
 // called at the start of each FS system call.
@@ -127,7 +287,7 @@ begin_op(int dev)
 {
   acquire(&log[dev].lock);
   while(1){
-    if(log[dev].committing){
+    if(log[dev].freezing){
       sleep(&log, &log[dev].lock);
     } else if(log[dev].lh.n + (log[dev].outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
@@ -141,19 +301,29 @@ begin_op(int dev)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// if this was the last outstanding operation, commits,
+// or, if another commit is in progress, waits for the
+// committer to commit this transaction next.
 void
 end_op(int dev)
 {
   int do_commit = 0;
+  uint seq;
 
   acquire(&log[dev].lock);
   log[dev].outstanding -= 1;
-  if(log[dev].committing)
-    panic("log[dev].committing");
-  if(log[dev].outstanding == 0){
-    do_commit = 1;
-    log[dev].committing = 1;
+  if(log[dev].freezing)
+    panic("log[dev].freezing");
+  seq = log[dev].seq;
+  if(log[dev].outstanding == 0 && log[dev].lh.n > 0){
+    if(log[dev].committing){
+      // the committer will pick this transaction up.
+      while(log[dev].done <= seq)
+        sleep(&log[dev].done, &log[dev].lock);
+    } else {
+      do_commit = 1;
+      log[dev].committing = 1;
+    }
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log[dev].outstanding has decreased
@@ -166,38 +336,257 @@ end_op(int dev)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit(dev);
-    acquire(&log[dev].lock);
-    log[dev].committing = 0;
-    wakeup(&log);
-    release(&log[dev].lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Write the committing transaction's header and frozen
+// blocks to the log, as one batch. Once they're all on
+// disk, the transaction has committed.
 static void
 write_log(int dev)
+{
+  struct logheader *lh = &log[dev].clh;
+  struct buf *bs[LOGSIZE+1];
+  int i;
+
+  lh->magic = LOGMAGIC;
+  lh->cksum = log_cksum(lh, log[dev].lbuf);
+  bs[0] = bgetnew(dev, ringblock(dev, log[dev].cpos));
+  memmove(bs[0]->data, lh, sizeof(*lh));
+  for (i = 0; i < lh->n; i++)
+    bs[i+1] = log[dev].lbuf[i];
+  bwritev(bs, lh->n+1);  // header and blocks together
+  brelse(bs[0]);
+}
+
+// Freeze the open transaction: make it the committing one,
+// and copy its blocks into log buffers, so that the next
+// transaction can change the cached blocks.
+// Called with log[dev].lock held, when the open transaction
+// has no outstanding operations and fits in the circular
+// buffer; returns with it released.
+static void
+freeze(int dev)
 {
   int tail;
 
-  for (tail = 0; tail < log[dev].lh.n; tail++) {
-    struct buf *to = bread(dev, log[dev].start+tail+1); // log block
-    struct buf *from = bread(dev, log[dev].lh.block[tail]); // cache block
+  log[dev].clh = log[dev].lh;
+  log[dev].clh.seq = log[dev].seq;
+  memmove(log[dev].cpin, log[dev].pin, sizeof(log[dev].pin));
+  log[dev].cpos = (log[dev].tail + log[dev].used) % log[dev].nring;
+  log[dev].lh.n = 0;
+  log[dev].cfreed = log[dev].freed;
+  log[dev].freed = 0;
+  log[dev].seq++;
+  log[dev].freezing = 1;
+  release(&log[dev].lock);
+
+  for (tail = 0; tail < log[dev].clh.n; tail++) {
+    struct buf *to = bgetnew(dev, ringblock(dev, log[dev].cpos+tail+1)); // log block
+    struct buf *from = bread(dev, log[dev].clh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
     brelse(from);
-    brelse(to);
+    log[dev].lbuf[tail] = to;
+  }
+
+  acquire(&log[dev].lock);
+  log[dev].freezing = 0;
+  wakeup(&log);
+  release(&log[dev].lock);
+}
+
+// Install the committed transactions in the log at their
+// home locations, and free their space in the log.
+// Called with log[dev].committing set, so the log
+// doesn't change underfoot.
+static void
+checkpoint(int dev)
+{
+  struct log *l = &log[dev];
+  int block[LOGSIZE], pos[LOGBLOCKS];
+  uint blocks[LOGSIZE];
+  uint seq;
+  int i, j, k, n, tail, used, s;
+
+  acquire(&l->lock);
+  tail = l->tail;
+  used = l->used;
+  release(&l->lock);
+  if(used == 0)
+    return;
+
+  // pick the newest logged copy of each block.
+  n = 0;
+  for(i = used - 1; i >= 0; i--){
+    s = (tail + i) % l->nring;
+    if(l->ring[s] == 0)
+      continue;  // a header
+    for(k = 0; k < n; k++)
+      if(l->ring[pos[k]]->blockno == l->ring[s]->blockno)
+        break;
+    if(k == n)
+      pos[n++] = s;
   }
+
+  // write them home, LOGSIZE at a time. the logged copies
+  // are usually still in the buffer cache.
+  for(i = 0; i < n; i += LOGSIZE){
+    k = n - i < LOGSIZE ? n - i : LOGSIZE;
+    for(j = 0; j < k; j++){
+      blocks[j] = ringblock(dev, pos[i+j]);
+      block[j] = l->ring[pos[i+j]]->blockno;
+    }
+    breadaheadv(dev, blocks, k);
+    for(j = 0; j < k; j++)
+      l->lbuf[j] = bread(dev, blocks[j]);
+    install_trans(dev, block, l->lbuf, k, 0);
+    for(j = 0; j < k; j++)
+      brelse(l->lbuf[j]);
+  }
+
+  // the log is empty: say so on disk before its space is
+  // reused, then let the cache evict the installed blocks.
+  acquire(&l->lock);
+  seq = l->seq;
+  release(&l->lock);
+  write_anchor(dev, (tail + used) % l->nring, seq);
+  for(i = 0; i < used; i++){
+    s = (tail + i) % l->nring;
+    if(l->ring[s]){
+      bunpin(l->ring[s]);
+      l->ring[s] = 0;
+    }
+  }
+
+  acquire(&l->lock);
+  l->tail = (tail + used) % l->nring;
+  l->used = 0;
+  release(&l->lock);
 }
 
+// Commit the open transaction, then any transaction
+// that filled up while this one was being committed.
+// Called with log[dev].committing set.
 static void
 commit(int dev)
 {
-  if (log[dev].lh.n > 0) {
-    write_log(dev);     // Write modified blocks from cache to log
-    write_head(dev);    // Write header to disk -- the real commit
-    install_trans(dev); // Now install writes to home locations
-    log[dev].lh.n = 0;
-    write_head(dev);    // Erase the transaction from the log
+  struct freed *f;
+  int tail, n, i;
+
+  acquire(&log[dev].lock);
+  while(log[dev].outstanding == 0 && log[dev].lh.n > 0){
+    if(log[dev].used + log[dev].lh.n + 1 > log[dev].nring){
+      // the log has wrapped around to its tail.
+      release(&log[dev].lock);
+      checkpoint(dev);
+      acquire(&log[dev].lock);
+      continue;
+    }
+    freeze(dev);
+
+    write_log(dev);     // Write header and frozen blocks -- the real commit
+    n = log[dev].clh.n;
+    for (tail = 0; tail < n; tail++) {
+      brelse(log[dev].lbuf[tail]);
+      // the cache block stays pinned until it's installed.
+      log[dev].ring[(log[dev].cpos+tail+1) % log[dev].nring] = log[dev].cpin[tail];
+    }
+    log[dev].ring[log[dev].cpos] = 0;
+    log[dev].clh.n = 0;
+    // the blocks it freed can be reused now.
+    while((f = log[dev].cfreed) != 0){
+      log[dev].cfreed = f->next;
+      for(i = 0; i < f->n; i++)
+        bfree_commit(dev, f->ext[i].start, f->ext[i].len);
+      kfree(f);
+    }
+
+    acquire(&log[dev].lock);
+    log[dev].used += n + 1;
+    log[dev].done = log[dev].seq;
+    wakeup(&log[dev].done);
+    wakeup(&log);
+  }
+  log[dev].committing = 0;
+  wakeup(&log);  // crash_op() may be waiting for the log.
+  release(&log[dev].lock);
+}
+
+// Like end_op(), but crash the system while committing the
+// transaction, for testing recovery; see sys_crash(). With
+// docrash 1 the crash comes once the transaction is in the
+// log, so recovery must replay it; with docrash 2 only its
+// header has been written, as if the commit were torn, so
+// recovery must ignore it. The caller must be the only FS
+// system call in progress.
+void
+crash_op(int dev, int docrash)
+{
+  struct logheader *lh = &log[dev].clh;
+  struct buf *bp;
+
+  if(docrash == 0){
+    end_op(dev);
+    return;
+  }
+
+  acquire(&log[dev].lock);
+  while(log[dev].committing)
+    sleep(&log, &log[dev].lock);
+  if(log[dev].outstanding != 1)
+    panic("crash_op: other FS calls in progress");
+  log[dev].outstanding = 0;
+  log[dev].committing = 1;
+  while(log[dev].used + log[dev].lh.n + 1 > log[dev].nring){
+    release(&log[dev].lock);
+    checkpoint(dev);
+    acquire(&log[dev].lock);
+  }
+  freeze(dev);
+
+  if(docrash == 1){
+    write_log(dev);
+  } else {
+    lh->magic = LOGMAGIC;
+    lh->cksum = log_cksum(lh, log[dev].lbuf);
+    bp = bgetnew(dev, ringblock(dev, log[dev].cpos));
+    memmove(bp->data, lh, sizeof(*lh));
+    bwrite(bp);
+    brelse(bp);
+  }
+  panic("crash_op: crashed");
+}
+
+// The log flusher thread of dev. Installs committed
+// transactions every LOGFLUSHTICKS, or sooner if the
+// log is more than half full, so that commits rarely
+// have to wait for a checkpoint.
+static void
+logflush(int dev)
+{
+  uint now, last;
+
+  last = ticks;
+  for(;;){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    now = ticks;
+    release(&tickslock);
+
+    acquire(&log[dev].lock);
+    if(log[dev].used == 0)
+      last = now;
+    if(log[dev].used == 0 || log[dev].committing ||
+       (log[dev].used < log[dev].nring/2 && now - last < LOGFLUSHTICKS)){
+      release(&log[dev].lock);
+      continue;
+    }
+    log[dev].committing = 1;
+    release(&log[dev].lock);
+
+    checkpoint(dev);
+    commit(dev);  // anything that ended meanwhile; clears committing.
+    last = now;
   }
 }
 
@@ -216,7 +605,7 @@ log_write(struct buf *b)
   int i;
 
   int dev = b->dev;
-  if (log[dev].lh.n >= LOGSIZE || log[dev].lh.n >= log[dev].size - 1)
+  if (log[dev].lh.n >= LOGSIZE)
     panic("too big a transaction");
   if (log[dev].outstanding < 1)
     panic("log_write outside of trans");
@@ -229,9 +618,45 @@ log_write(struct buf *b)
   log[dev].lh.block[i] = b->blockno;
   if (i == log[dev].lh.n) {  // Add new block to log?
     bpin(b);
+    log[dev].pin[i] = b;
     log[dev].lh.n++;
   }
   release(&log[dev].lock);
 }
 
+// The open transaction frees blocks start..start+len-1.
+// Keep them out of the free block index until the
+// transaction commits, when commit() hands them to
+// bfree_commit(). If there's no memory to note them,
+// they're only lost until the next boot, which finds
+// them free in the bitmap.
+void
+log_free(int dev, uint start, uint len)
+{
+  struct freed *f;
+  struct extent *e;
+
+  if (log[dev].outstanding < 1)
+    panic("log_free outside of trans");
 
+  acquire(&log[dev].lock);
+  f = log[dev].freed;
+  e = f && f->n > 0 ? &f->ext[f->n-1] : 0;
+  if(e && e->start + e->len == start){
+    e->len += len;
+  } else {
+    if(f == 0 || f->n == NELEM(f->ext)){
+      if((f = kalloc()) == 0){
+        release(&log[dev].lock);
+        return;
+      }
+      f->n = 0;
+      f->next = log[dev].freed;
+      log[dev].freed = f;
+    }
+    f->ext[f->n].start = start;
+    f->ext[f->n].len = len;
+    f->n++;
+  }
+  release(&log[dev].lock);
+}
@@ -21,6 +21,7 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slabinit();      // kernel object caches
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -31,6 +32,8 @@ main()
     binit();         // buffer cache
     iinit();         // inode cache
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    mmapinit();      // file page cache for mmap
     virtio_disk_init(minor(ROOTDEV)); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
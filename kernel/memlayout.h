@@ -14,7 +14,8 @@
 
 // the kernel uses physical memory thus:
 // 80000000 -- entry.S, then kernel text and data
-// end -- start of kernel page allocation area
+// end -- start of the kernel heap (buddy allocator), KHEAPSIZE bytes
+// end+KHEAPSIZE -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
 
 // qemu puts UART registers here in physical memory.
@@ -48,6 +49,10 @@
 #define KERNBASE 0x80000000L
 #define PHYSTOP (KERNBASE + 128*1024*1024)
 
+// size of the region after the kernel that is managed
+// by the buddy allocator, for the slab caches.
+#define KHEAPSIZE (1024*1024)
+
 // map the trampoline page to the highest address,
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
@@ -0,0 +1,411 @@
+// Memory-mapped files.
+//
+// mmap() records a struct vma in the process; pages are
+// filled in lazily by mmapfault() when the process first
+// touches them.
+//
+// File pages come from a small page cache, keyed by
+// (dev, inum, offset), which holds a reference to each
+// of its physical pages. A fault maps the cached page
+// itself, so read-only and shared mappings never copy file
+// data, and processes mapping the same file share the same
+// physical pages. A private writable mapping maps the cached
+// page copy-on-write. writei() keeps cached pages up to date,
+// and itrunc() drops the pages of a file that's freed.
+//
+// A shared writable mapping is first mapped read-only; the
+// first store makes the page writable, and only pages that
+// are writable get written back to the file, by munmap()
+// or exit().
+
+#include "types.h"
+#include "riscv.h"
+#include "memlayout.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+#define NPCACHE 64  // pages in the file page cache
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint off;         // file offset, page aligned
+  char *pa;         // physical page; 0 if the slot is unused
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+} pcache;
+
+void
+mmapinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Return the physical page holding the file data of ip at
+// offset off, with a reference for the caller. Reads the
+// page into the cache if it isn't there. Beyond the end of
+// the file, returns a fresh page of zeros.
+// Caller must hold ip->lock, which also keeps two
+// processes from reading in the same page at once.
+// Returns 0 if out of memory, or if shared is set and
+// there's no room in the cache: a page outside it
+// wouldn't be seen by the file's other mappings.
+static char*
+pcache_get(struct inode *ip, uint off, int shared)
+{
+  struct cpage *cp, *victim;
+  char *pa;
+  uint n;
+
+  acquire(&pcache.lock);
+  for(cp = pcache.page; cp < &pcache.page[NPCACHE]; cp++){
+    if(cp->pa && cp->dev == ip->dev && cp->inum == ip->inum && cp->off == off){
+      kincref(cp->pa);
+      release(&pcache.lock);
+      return cp->pa;
+    }
+  }
+  release(&pcache.lock);
+
+  if((pa = kalloc_zeroed()) == 0)
+    return 0;
+  if(off >= ip->size)
+    return pa;
+  n = ip->size - off;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if(readi(ip, 0, (uint64)pa, off, n) != n){
+    kfree(pa);
+    return 0;
+  }
+
+  // keep the page in the cache, replacing a page that
+  // no process has mapped. if there's none, a private
+  // mapping gets a page of its own.
+  acquire(&pcache.lock);
+  victim = 0;
+  for(cp = pcache.page; cp < &pcache.page[NPCACHE]; cp++){
+    if(cp->pa == 0){
+      victim = cp;
+      break;
+    }
+    if(victim == 0 && krefcnt(cp->pa) == 1)
+      victim = cp;
+  }
+  if(victim){
+    if(victim->pa)
+      kfree(victim->pa);
+    victim->dev = ip->dev;
+    victim->inum = ip->inum;
+    victim->off = off;
+    victim->pa = pa;
+    kincref(pa);
+  } else if(shared){
+    kfree(pa);
+    pa = 0;
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Copy n bytes at src, just written to ip at offset off,
+// into any cached pages of ip that they overlap.
+// Called by writei().
+void
+pcache_update(struct inode *ip, uint off, char *src, uint n)
+{
+  struct cpage *cp;
+  uint a, b;
+
+  acquire(&pcache.lock);
+  for(cp = pcache.page; cp < &pcache.page[NPCACHE]; cp++){
+    if(cp->pa == 0 || cp->dev != ip->dev || cp->inum != ip->inum)
+      continue;
+    a = off > cp->off ? off : cp->off;
+    b = off + n < cp->off + PGSIZE ? off + n : cp->off + PGSIZE;
+    if(a < b)
+      memmove(cp->pa + (a - cp->off), src + (a - off), b - a);
+  }
+  release(&pcache.lock);
+}
+
+// Drop the cached pages of ip, whose contents
+// are being discarded. Mappings keep their pages.
+void
+pcache_inval(struct inode *ip)
+{
+  struct cpage *cp;
+
+  acquire(&pcache.lock);
+  for(cp = pcache.page; cp < &pcache.page[NPCACHE]; cp++){
+    if(cp->pa && cp->dev == ip->dev && cp->inum == ip->inum){
+      kfree(cp->pa);
+      cp->pa = 0;
+    }
+  }
+  release(&pcache.lock);
+}
+
+static struct vma*
+findvma(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Map len bytes of file f, starting at offset off, into
+// the current process. The kernel picks the address: the
+// highest free range below the trapframe.
+// Returns the address, or -1.
+uint64
+mmap(uint64 addr, int len, int prot, int flags, struct file *f, int off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *free;
+  uint64 a, sz;
+
+  if(len <= 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+
+  sz = PGROUNDUP((uint64)len);  // in int, would overflow near INT_MAX
+  free = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len == 0){
+      free = v;
+      break;
+    }
+  if(free == 0)
+    return -1;
+
+  a = TRAPFRAME - sz;
+again:
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len && a < v->addr + v->len && v->addr < a + sz){
+      a = v->addr - sz;
+      goto again;
+    }
+  }
+  if(a < PGROUNDUP(p->sz) || a > TRAPFRAME)
+    return -1;
+
+  free->addr = a;
+  free->len = sz;
+  free->prot = prot;
+  free->flags = flags;
+  free->off = off;
+  free->f = filedup(f);
+  return a;
+}
+
+// Handle a page fault at va in a mapped file.
+// Returns 0 if the access can be retried, -1 if it's
+// not allowed, or there's no memory or, for a shared
+// mapping, no room in the page cache.
+// Locks the file's inode, so code that copies to or from
+// user memory while holding an inode lock must fault the
+// pages in first, with uvmprefault().
+int
+mmapfault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+  pte_t *pte;
+  struct inode *ip;
+  char *pa;
+  int perm;
+
+  if((v = findvma(p, va)) == 0)
+    return -1;
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(write == 0)
+      return -1;
+    if(v->flags == MAP_PRIVATE)
+      return cowfault(p->pagetable, va);
+    *pte |= PTE_W;  // first store to a shared page: now dirty.
+    return 0;
+  }
+
+  ip = v->f->ip;
+  ilock(ip);
+  pa = pcache_get(ip, v->off + (va - v->addr), v->flags == MAP_SHARED);
+  iunlock(ip);
+  if(pa == 0)
+    return -1;
+
+  perm = PTE_U | PTE_R;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(v->prot & PROT_WRITE){
+    if(v->flags == MAP_PRIVATE)
+      perm |= PTE_COW;
+    else if(write)
+      perm |= PTE_W;
+  }
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)pa, perm) != 0){
+    kfree(pa);
+    return -1;
+  }
+  if(write && v->flags == MAP_PRIVATE)
+    return cowfault(p->pagetable, va);
+  return 0;
+}
+
+// Write the dirty pages of shared mapping v in
+// [va, va+len) back to the file, up to its current size.
+static void
+writeback(struct proc *p, struct vma *v, uint64 va, uint64 len)
+{
+  struct inode *ip = v->f->ip;
+  int max = MAXOPWRITE;  // as in filewrite()
+  pte_t *pte;
+  uint64 a, pa;
+  uint off, i, n;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_W) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    off = v->off + (a - v->addr);
+    for(i = 0; i < PGSIZE; i += n){
+      n = PGSIZE - i;
+      if(n > max)
+        n = max;
+      begin_op(ip->dev);
+      ilock(ip);
+      if(off + i < ip->size){
+        if(off + i + n > ip->size)
+          n = ip->size - off - i;
+        writei(ip, 0, pa + i, off + i, n);
+      } else {
+        n = PGSIZE - i;
+      }
+      iunlock(ip);
+      end_op(ip->dev);
+    }
+  }
+}
+
+// Unmap [addr, addr+len) from the current process.
+// The range must cover the start or the end of a
+// single mapping. Returns 0, or -1 on a bad range.
+int
+munmap(uint64 addr, int len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  struct file *f;
+  uint64 sz;
+
+  if(addr % PGSIZE != 0 || len <= 0)
+    return -1;
+  sz = PGROUNDUP((uint64)len);
+  if((v = findvma(p, addr)) == 0 || addr + sz > v->addr + v->len)
+    return -1;
+  if(addr != v->addr && addr + sz != v->addr + v->len)
+    return -1;  // would punch a hole
+
+  if(v->flags == MAP_SHARED && (v->prot & PROT_WRITE))
+    writeback(p, v, addr, sz);
+  uvmunmap(p->pagetable, addr, sz, 1);
+
+  if(addr == v->addr){
+    v->addr += sz;
+    v->off += sz;
+  }
+  v->len -= sz;
+  if(v->len == 0){
+    f = v->f;
+    v->f = 0;
+    fileclose(f);
+  }
+  return 0;
+}
+
+// Remove all of p's mappings, writing back shared ones.
+// Called by exit() and exec().
+void
+munmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    if(v->flags == MAP_SHARED && (v->prot & PROT_WRITE))
+      writeback(p, v, v->addr, v->len);
+    uvmunmap(p->pagetable, v->addr, v->len, 1);
+    v->len = 0;
+    fileclose(v->f);
+    v->f = 0;
+  }
+}
+
+// Give child np the mappings of p. Pages that are
+// already mapped are shared: shared mappings keep their
+// permissions, private ones become copy-on-write in both.
+// Doesn't sleep, since np->lock is held.
+// Returns 0, or -1 with np left without mappings.
+int
+mmapcopy(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  pte_t *pte;
+  uint64 a, pa;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    if(v->len == 0)
+      continue;
+    *nv = *v;
+    filedup(nv->f);
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if(v->flags == MAP_PRIVATE && (*pte & PTE_W))
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      pa = PTE2PA(*pte);
+      if(mappages(np->pagetable, a, PGSIZE, pa, PTE_FLAGS(*pte)) != 0)
+        goto err;
+      kincref((void*)pa);
+    }
+  }
+  return 0;
+
+ err:
+  // the parent still holds every file, so
+  // fileclose() won't sleep to release an inode.
+  for(nv = np->vma; nv < &np->vma[NVMA]; nv++){
+    if(nv->len == 0)
+      continue;
+    uvmunmap(np->pagetable, nv->addr, nv->len, 1);
+    fileclose(nv->f);
+    nv->len = 0;
+    nv->f = 0;
+  }
+  return -1;
+}
@@ -1,14 +1,20 @@
-#define NPROC        10  // maximum number of processes
+#define NKTHREAD      1  // kernel threads: the log flusher of ROOTDEV
+#define NPROC        (10+NKTHREAD)  // maximum number of processes, kernel threads included
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NVMA         16  // mmap regions per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // unused i-nodes kept cached
+#define NDENTRY     128  // cached directory lookups
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       0  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in one log transaction
+#define LOGBLOCKS    (LOGSIZE*3)  // size of on-disk log, in blocks
+#define NBUF         (LOGBLOCKS+2*LOGSIZE+MAXOPBLOCKS)  // minimum size of disk block cache
+#define MAXIOBLOCKS  16  // max blocks in one disk request
+#define BCACHEFRAC   32  // disk block cache may grow to 1/BCACHEFRAC of RAM
+#define FSSIZE       4000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define NDISK        2
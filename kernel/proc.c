@@ -19,6 +19,7 @@ int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void wakeup1(struct proc *chan);
 
 extern char trampoline[]; // trampoline.S
@@ -221,19 +222,41 @@ userinit(void)
   release(&p->lock);
 }
 
+// Start a kernel thread, named name, that runs fn(arg).
+// It has no user memory, never returns to user space,
+// and fn must not return. It holds a proc slot for good,
+// so each one must be counted in NKTHREAD.
+void
+kthread(char *name, void (*fn)(int), int arg)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->context.ra = (uint64)kthreadret;
+  p->kfn = fn;
+  p->karg = arg;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    // pages are allocated lazily, on first touch, by
+    // uvmfault(). don't hand out more address space
+    // than there is physical memory.
+    if(sz + n > PHYSTOP - KERNBASE)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -263,6 +286,13 @@ fork(void)
   }
   np->sz = p->sz;
 
+  // share mapped files.
+  if(mmapcopy(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
   np->parent = p;
 
   // copy saved user registers.
@@ -325,6 +355,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Unmap mapped files, writing back shared ones.
+  munmapall(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -482,7 +515,11 @@ scheduler(void)
       release(&p->lock);
     }
     if(found == 0){
-      asm volatile("wfi");
+      // nothing to run. spend the idle time zeroing a page
+      // for kalloc_zeroed(), and only wait for an interrupt
+      // once the zeroed-page pool is full.
+      if(kzero_refill() == 0)
+        asm volatile("wfi");
     }
   }
 }
@@ -546,6 +583,20 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn(p->karg);
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
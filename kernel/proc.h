@@ -82,6 +82,16 @@ struct trapframe {
 
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A region of a file mapped by mmap().
+struct vma {
+  uint64 addr;                 // start, page aligned
+  uint64 len;                  // length in bytes; 0 if unused
+  int prot;                    // PROT_*
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // mapped file
+  uint off;                    // file offset of addr
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -101,6 +111,9 @@ struct proc {
   struct trapframe *tf;        // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
+  struct vma vma[NVMA];        // Mapped files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfn)(int);            // Body of a kernel thread
+  int karg;                    // Its argument
 };
@@ -0,0 +1,263 @@
+// Slab allocator for small kernel objects.
+//
+// A kmem_cache hands out fixed-size objects (pipes, file
+// structures, ...) carved out of SLABSIZE-byte slabs that
+// come from the buddy allocator in buddy.c. Each slab starts
+// with a struct slab header; since buddy blocks of size SLABSIZE
+// are SLABSIZE-aligned, the header of an object's slab is found
+// by rounding the object's address down.
+//
+// Each CPU keeps a small magazine of free objects per cache,
+// so that most allocations and frees don't touch the cache's
+// lock. Magazines are refilled from, and flushed back to, the
+// slabs in batches of NMAG/2 objects.
+//
+// Interface:
+// * kmem_cache_create(name, size) makes a cache at boot.
+// * kmem_cache_alloc(c) returns an object, or 0 if out of memory.
+//   The contents of the object are undefined.
+// * kmem_cache_free(c, obj) gives an object back.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "stat.h"
+#include "defs.h"
+
+#define SLABSIZE  PGSIZE  // bytes per slab; must be a power of two
+#define NMAG      8       // objects per per-CPU magazine
+#define NKCACHE   16      // maximum number of caches
+
+struct slab {
+  struct slab *next;        // on the cache's list of slabs
+  struct slab *prev;
+  struct kmem_cache *cache;
+  void *free;               // free objects in this slab
+  int inuse;                // objects handed out from this slab
+};
+
+struct magazine {
+  int n;
+  void *obj[NMAG];
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;                // object size, rounded up to 8 bytes
+  int perslab;              // objects in one slab
+  int nslab;                // slabs owned by this cache
+  int nalloc;               // objects handed out to callers
+  struct slab slabs;        // list of slabs with free objects
+  struct magazine mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  int n;
+  struct kmem_cache cache[NKCACHE];
+} kcaches;
+
+static int
+slab_empty(struct kmem_cache *c)
+{
+  return c->slabs.next == &c->slabs;
+}
+
+static void
+slab_remove(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+static void
+slab_push(struct kmem_cache *c, struct slab *s)
+{
+  s->next = c->slabs.next;
+  s->prev = &c->slabs;
+  c->slabs.next->prev = s;
+  c->slabs.next = s;
+}
+
+// Create a cache of objects of the given size.
+// Only called during boot; panics if there's no room.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(void*) || size > SLABSIZE - sizeof(struct slab))
+    panic("kmem_cache_create: size");
+
+  acquire(&kcaches.lock);
+  if(kcaches.n >= NKCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &kcaches.cache[kcaches.n++];
+  release(&kcaches.lock);
+
+  initlock(&c->lock, "slab");
+  c->name = name;
+  c->size = size;
+  c->perslab = (SLABSIZE - sizeof(struct slab)) / size;
+  c->slabs.next = &c->slabs;
+  c->slabs.prev = &c->slabs;
+  return c;
+}
+
+// Get a new slab from the buddy allocator and put all of
+// its objects on the slab's free list.
+// Caller must hold c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *p;
+
+  if((s = bd_malloc(SLABSIZE)) == 0)
+    return 0;
+  if((uint64)s % SLABSIZE != 0)
+    panic("slab_grow: alignment");
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  p = (char*)(s + 1);
+  for(int i = 0; i < c->perslab; i++, p += c->size){
+    *(void**)p = s->free;
+    s->free = p;
+  }
+  slab_push(c, s);
+  c->nslab++;
+  return s;
+}
+
+// Move up to n objects from the slabs into magazine m.
+// Caller must hold c->lock.
+static void
+mag_fill(struct kmem_cache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  while(m->n < n){
+    if(slab_empty(c) && slab_grow(c) == 0)
+      break;
+    s = c->slabs.next;
+    obj = s->free;
+    s->free = *(void**)obj;
+    s->inuse++;
+    if(s->free == 0)
+      slab_remove(s);  // full; found again through its objects.
+    m->obj[m->n++] = obj;
+  }
+}
+
+// Give the newest n objects of magazine m back to their slabs,
+// returning slabs that become unused to the buddy allocator.
+// Caller must hold c->lock.
+static void
+mag_flush(struct kmem_cache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  while(n-- > 0 && m->n > 0){
+    obj = m->obj[--m->n];
+    s = (struct slab*)((uint64)obj & ~(SLABSIZE - 1));
+    if(s->cache != c)
+      panic("kmem_cache_free: wrong cache");
+    if(s->free == 0)
+      slab_push(c, s);  // was full; has a free object again.
+    *(void**)obj = s->free;
+    s->free = obj;
+    s->inuse--;
+    if(s->inuse == 0 && (c->slabs.next != s || s->next != &c->slabs)){
+      // unused, and not the cache's only slab with free
+      // objects: give it back.
+      slab_remove(s);
+      c->nslab--;
+      bd_free(s);
+    }
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    mag_fill(c, m, NMAG/2);
+    release(&c->lock);
+  }
+  obj = 0;
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  pop_off();
+
+  if(obj)
+    __sync_fetch_and_add(&c->nalloc, 1);
+  return obj;
+}
+
+// Return an object to cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+  if(obj == 0)
+    panic("kmem_cache_free");
+  __sync_fetch_and_sub(&c->nalloc, 1);
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == NMAG){
+    acquire(&c->lock);
+    mag_flush(c, m, NMAG/2);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  pop_off();
+}
+
+void
+slabinit(void)
+{
+  initlock(&kcaches.lock, "kcaches");
+}
+
+// Fill in *st with the memory usage of the i'th cache,
+// if there is one. Returns the number of caches.
+int
+kmem_cache_stat(int i, struct kmemstat *st)
+{
+  struct kmem_cache *c;
+  int n;
+
+  acquire(&kcaches.lock);
+  n = kcaches.n;
+  release(&kcaches.lock);
+  if(i < 0 || i >= n)
+    return n;
+
+  c = &kcaches.cache[i];
+  memset(st, 0, sizeof(*st));
+  safestrcpy(st->name, c->name, sizeof(st->name));
+  acquire(&c->lock);
+  st->objsize = c->size;
+  st->nalloc = c->nalloc;
+  st->nslab = c->nslab;
+  st->bytes = (uint64)c->nslab * SLABSIZE;
+  release(&c->lock);
+  return n;
+}
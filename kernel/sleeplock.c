@@ -16,15 +16,19 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->readers = 0;
+  lk->wwait = 0;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->wwait++;
+  while (lk->locked || lk->readers > 0) {
     sleep(lk, &lk->lk);
   }
+  lk->wwait--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
   release(&lk->lk);
@@ -40,6 +44,48 @@ releasesleep(struct sleeplock *lk)
   release(&lk->lk);
 }
 
+// Acquire lk if no one holds it or is waiting for it,
+// without sleeping. Returns 1 if it was acquired, 0 if not.
+int
+tryacquiresleep(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = !lk->locked && lk->readers == 0 && lk->wwait == 0;
+  if(r){
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+  }
+  release(&lk->lk);
+  return r;
+}
+
+// Acquire lk shared with other readers. Waits while a
+// process holds the lock or is waiting to, so that a
+// stream of readers can't keep a writer out forever.
+void
+acquiresleep_shared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->wwait > 0) {
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+void
+releasesleep_shared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasesleep_shared");
+  if(--lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
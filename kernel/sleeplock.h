@@ -1,7 +1,10 @@
-// Long-term locks for processes
+// Long-term locks for processes.
+// Held either by one process, or shared by readers.
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+  int readers;       // Processes holding it shared
+  int wwait;         // Processes waiting to hold it themselves
   
   // For debugging:
   char *name;        // Name of lock.
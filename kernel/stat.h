@@ -9,3 +9,21 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// Memory used by one kernel object cache, see kmemstat().
+struct kmemstat {
+  char name[16];  // Cache name
+  uint objsize;   // Size of one object in bytes
+  uint nalloc;    // Objects currently allocated
+  uint nslab;     // Slabs owned by the cache
+  uint64 bytes;   // Memory held by the cache's slabs
+};
+
+// File system usage, see statfs().
+struct statfs {
+  uint bsize;     // Block size in bytes
+  uint nblocks;   // Data blocks
+  uint bfree;     // Free data blocks
+  uint ninodes;   // Inodes that files can use
+  uint ifree;     // Free inodes
+};
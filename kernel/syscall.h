@@ -23,3 +23,8 @@
 
 // System calls for labs
 #define SYS_ntas   22
+#define SYS_kmemstat 23
+#define SYS_mmap   24
+#define SYS_munmap 25
+#define SYS_statfs 26
+#define SYS_crash  27
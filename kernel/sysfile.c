@@ -185,7 +185,6 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -215,9 +214,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -483,3 +480,72 @@ sys_pipe(void)
   return 0;
 }
 
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr;
+  int len, prot, flags, off;
+  struct file *f;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+    return -1;
+  return mmap(addr, len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+// Report the usage of the file system that holds path.
+uint64
+sys_statfs(void)
+{
+  char path[MAXPATH];
+  struct inode *ip;
+  struct statfs st;
+  uint64 addr; // user pointer to struct statfs
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &addr) < 0)
+    return -1;
+  begin_op(ROOTDEV);
+  if((ip = namei(path)) == 0){
+    end_op(ROOTDEV);
+    return -1;
+  }
+  fsstat(ip->dev, &st);
+  iput(ip);
+  end_op(ROOTDEV);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Create the file path, and crash the system while committing
+// it, for testing the log's recovery; see crash_op().
+uint64
+sys_crash(void)
+{
+  char path[MAXPATH];
+  struct inode *ip;
+  int docrash;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &docrash) < 0)
+    return -1;
+  begin_op(ROOTDEV);
+  if((ip = create(path, T_FILE, 0, 0)) == 0){
+    end_op(ROOTDEV);
+    return -1;
+  }
+  iunlockput(ip);
+  crash_op(ROOTDEV, docrash);
+  return 0;
+}
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "stat.h"
 
 uint64
 sys_exit(void)
@@ -95,3 +96,25 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// Copy per-cache memory usage out to the user array
+// of struct kmemstat at addr, which has room for n entries.
+// Returns the number of caches.
+uint64
+sys_kmemstat(void)
+{
+  struct kmemstat st;
+  uint64 addr;
+  int n, i, ncache;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+
+  ncache = kmem_cache_stat(-1, &st);
+  for(i = 0; i < ncache && i < n; i++){
+    kmem_cache_stat(i, &st);
+    if(copyout(myproc()->pagetable, addr + i*sizeof(st), (char*)&st, sizeof(st)) < 0)
+      return -1;
+  }
+  return ncache;
+}
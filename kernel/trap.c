@@ -70,6 +70,12 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 13 || r_scause() == 15) &&
+            (uvmfault(p->pagetable, r_stval(), p->sz, r_scause() == 15) == 0 ||
+             mmapfault(p, r_stval(), r_scause() == 15) == 0)){
+    // load or store page fault on a heap or mapped-file page
+    // that hadn't been touched yet, or store to a copy-on-write
+    // page.
   } else {
     printf("usertrap(): unexpected scause %p (%s) pid=%d\n", r_scause(), scause_desc(r_scause()), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
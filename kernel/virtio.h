@@ -44,8 +44,9 @@
 #define VIRTIO_RING_F_EVENT_IDX     29
 
 // this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// must be a power of two, and leave room for
+// requests of MAXIOBLOCKS blocks.
+#define NUM 64
 
 struct VRingDesc {
   uint64 addr;
@@ -65,6 +66,13 @@ struct VRingUsedElem {
 #define VIRTIO_BLK_T_IN  0 // read the disk
 #define VIRTIO_BLK_T_OUT 1 // write the disk
 
+// the first descriptor of a disk op points to one of these.
+struct virtio_blk_outhdr {
+  uint32 type;
+  uint32 reserved;
+  uint64 sector;
+};
+
 struct UsedArea {
   uint16 flags;
   uint16 id;
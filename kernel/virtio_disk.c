@@ -39,10 +39,16 @@ struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b[MAXIOBLOCKS];
+    int nb;
+    char write;
     char status;
   } info[NUM];
 
+  // disk command headers, one per chain, indexed like info.
+  // in the kernel's data, so they are direct-mapped.
+  struct virtio_blk_outhdr ops[NUM];
+
   // initialized?
   int init;
 
@@ -163,10 +169,12 @@ free_chain(int n, int i)
   }
 }
 
+// allocate cnt descriptors into idx[].
+// returns -1, with none allocated, if there aren't enough.
 static int
-alloc3_desc(int n, int *idx)
+alloc_descs(int n, int cnt, int *idx)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < cnt; i++){
     idx[i] = alloc_desc(n);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -177,67 +185,84 @@ alloc3_desc(int n, int *idx)
   return 0;
 }
 
+// Start a read or write of bufs b[0..nb-1], which must hold
+// consecutive blocks, as a single disk request, without
+// waiting for it to finish. nb is at most MAXIOBLOCKS.
+// Many requests can be outstanding at once.
+// Sets b[i]->disk until the disk is done with the request;
+// a read also sets b[i]->valid when it completes. The caller
+// must not touch the data (or let the bufs be recycled) until
+// then; see virtio_disk_wait().
 void
-virtio_disk_rw(int n, struct buf *b, int write)
+virtio_disk_submitv(int n, struct buf **b, int nb, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = b[0]->blockno * (BSIZE / 512);
+  int i;
+
+  if(nb < 1 || nb > MAXIOBLOCKS)
+    panic("virtio_disk_submitv");
+  for(i = 1; i < nb; i++)
+    if(b[i]->blockno != b[0]->blockno + i)
+      panic("virtio_disk_submitv: not consecutive");
 
   acquire(&disk[n].vdisk_lock);
 
-  // the spec says that legacy block operations use three
-  // descriptors: one for type/reserved/sector, one for
-  // the data, one for a 1-byte status result.
+  // the spec says that legacy block operations use one
+  // descriptor for type/reserved/sector, then descriptors
+  // for the data, then one for a 1-byte status result.
+  // the data may be spread over several descriptors: one
+  // per buf.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
+  int idx[MAXIOBLOCKS+2];
   while(1){
-    if(alloc3_desc(n, idx) == 0) {
+    if(alloc_descs(n, nb+2, idx) == 0) {
       break;
     }
     sleep(&disk[n].free[0], &disk[n].vdisk_lock);
   }
   
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
+  struct virtio_blk_outhdr *buf0 = &disk[n].ops[idx[0]];
 
   if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk[n].desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk[n].desc[idx[0]].len = sizeof(buf0);
+    buf0->type = VIRTIO_BLK_T_IN; // read the disk
+  buf0->reserved = 0;
+  buf0->sector = sector;
+
+  disk[n].desc[idx[0]].addr = (uint64) buf0;
+  disk[n].desc[idx[0]].len = sizeof(*buf0);
   disk[n].desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk[n].desc[idx[0]].next = idx[1];
 
-  disk[n].desc[idx[1]].addr = (uint64) b->data;
-  disk[n].desc[idx[1]].len = BSIZE;
-  if(write)
-    disk[n].desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk[n].desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk[n].desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk[n].desc[idx[1]].next = idx[2];
+  for(i = 0; i < nb; i++){
+    disk[n].desc[idx[1+i]].addr = (uint64) b[i]->data;
+    disk[n].desc[idx[1+i]].len = BSIZE;
+    if(write)
+      disk[n].desc[idx[1+i]].flags = 0; // device reads b->data
+    else
+      disk[n].desc[idx[1+i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk[n].desc[idx[1+i]].flags |= VRING_DESC_F_NEXT;
+    disk[n].desc[idx[1+i]].next = idx[2+i];
+  }
 
   disk[n].info[idx[0]].status = 0;
-  disk[n].desc[idx[2]].addr = (uint64) &disk[n].info[idx[0]].status;
-  disk[n].desc[idx[2]].len = 1;
-  disk[n].desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk[n].desc[idx[2]].next = 0;
-
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk[n].info[idx[0]].b = b;
+  disk[n].desc[idx[nb+1]].addr = (uint64) &disk[n].info[idx[0]].status;
+  disk[n].desc[idx[nb+1]].len = 1;
+  disk[n].desc[idx[nb+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk[n].desc[idx[nb+1]].next = 0;
+
+  // record struct bufs for virtio_disk_intr().
+  for(i = 0; i < nb; i++){
+    b[i]->disk = 1;
+    disk[n].info[idx[0]].b[i] = b[i];
+  }
+  disk[n].info[idx[0]].nb = nb;
+  disk[n].info[idx[0]].write = write;
 
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
@@ -249,20 +274,40 @@ virtio_disk_rw(int n, struct buf *b, int write)
 
   *R(n, VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  release(&disk[n].vdisk_lock);
+}
+
+// Start a read or write of b alone.
+void
+virtio_disk_submit(int n, struct buf *b, int write)
+{
+  virtio_disk_submitv(n, &b, 1, write);
+}
+
+// Wait for the disk to finish with b, if it
+// has a request outstanding.
+void
+virtio_disk_wait(int n, struct buf *b)
+{
+  acquire(&disk[n].vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk[n].vdisk_lock);
   }
-
-  disk[n].info[idx[0]].b = 0;
-  free_chain(n, idx[0]);
-
   release(&disk[n].vdisk_lock);
 }
 
+void
+virtio_disk_rw(int n, struct buf *b, int write)
+{
+  virtio_disk_submit(n, b, write);
+  virtio_disk_wait(n, b);
+}
+
 void
 virtio_disk_intr(int n)
 {
+  struct buf *b;
+
   acquire(&disk[n].vdisk_lock);
 
   while((disk[n].used_idx % NUM) != (disk[n].used->id % NUM)){
@@ -270,13 +315,20 @@ virtio_disk_intr(int n)
 
     if(disk[n].info[id].status != 0)
       panic("virtio_disk_intr status");
-    
-    disk[n].info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk[n].info[id].b);
+
+    free_chain(n, id);
+
+    for(int i = 0; i < disk[n].info[id].nb; i++){
+      b = disk[n].info[id].b[i];
+      disk[n].info[id].b[i] = 0;
+      if(!disk[n].info[id].write)
+        b->valid = 1;
+      b->disk = 0;   // disk is done with buf
+      wakeup(b);
+    }
 
     disk[n].used_idx = (disk[n].used_idx + 1) % NUM;
   }
 
   release(&disk[n].vdisk_lock);
 }
-
@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -11,6 +13,11 @@
  */
 pagetable_t kernel_pagetable;
 
+// a page of zeros, mapped read-only and copy-on-write
+// wherever a process reads heap it hasn't written yet.
+// holds a reference of its own, so it's never freed.
+static char *zeropage;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -25,8 +32,9 @@ void print(pagetable_t);
 void
 kvminit()
 {
-  kernel_pagetable = (pagetable_t) kalloc();
-  memset(kernel_pagetable, 0, PGSIZE);
+  kernel_pagetable = (pagetable_t) kalloc_zeroed();
+  if((zeropage = kalloc_zeroed()) == 0)
+    panic("kvminit: zeropage");
 
   // uart registers
   kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -75,7 +83,7 @@ kvminithart()
 //   21..39 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..12 -- 12 bits of byte offset within the page.
-static pte_t *
+pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
   if(va >= MAXVA)
@@ -86,9 +94,8 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
@@ -174,9 +181,9 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
-// Remove mappings from a page table. The mappings in
-// the given range must exist. Optionally free the
-// physical memory.
+// Remove mappings from a page table. Pages in the
+// range that were never faulted in are skipped.
+// Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
 {
@@ -187,12 +194,8 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0){
-      printf("va=%p pte=%p\n", a, *pte);
-      panic("uvmunmap: not mapped");
-    }
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      goto next;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -200,6 +203,7 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
       kfree((void*)pa);
     }
     *pte = 0;
+  next:
     if(a == last)
       break;
     a += PGSIZE;
@@ -212,10 +216,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     panic("uvmcreate: out of memory");
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -229,8 +232,7 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -249,12 +251,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   oldsz = PGROUNDUP(oldsz);
   a = oldsz;
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -312,8 +313,11 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies the page table, but not the physical
+// memory: parent and child share each page, and
+// writable pages are marked copy-on-write in
+// both; see cowfault(). Pages that haven't been
+// faulted in yet stay that way in the child.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -322,22 +326,17 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    kincref((void*)pa);
   }
   return 0;
 
@@ -346,6 +345,148 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Give the page at user virtual address va its own
+// writable copy, if it is a copy-on-write page.
+// If no one else refers to the page any more,
+// just make it writable again.
+// The caller must flush the TLB (usertrapret
+// does when it installs the user page table).
+// Returns 0 on success, -1 if va isn't a copy-on-write
+// page or there's no memory.
+int
+cowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+
+  if(pa == (uint64)zeropage){
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)pa, PGSIZE);
+  }
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return 0;
+}
+
+// Handle a page fault at user virtual address va,
+// in a process of size sz. A page below sz that has
+// never been touched is filled in: a read maps the
+// shared zero page, a write allocates a zeroed page.
+// A write to a copy-on-write page breaks the sharing.
+// Returns 0 if the access can be retried, -1 if the
+// address is bad or there's no memory.
+int
+uvmfault(pagetable_t pagetable, uint64 va, uint64 sz, int write)
+{
+  pte_t *pte;
+  char *mem;
+
+  if(va >= sz || va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    // mapped, e.g. the stack guard page: only a write
+    // to a copy-on-write page is allowed to fault.
+    if(write)
+      return cowfault(pagetable, va);
+    return -1;
+  }
+
+  if(write == 0){
+    if(mappages(pagetable, va, PGSIZE, (uint64)zeropage, PTE_R|PTE_X|PTE_U|PTE_COW) != 0)
+      return -1;
+    kincref(zeropage);
+    return 0;
+  }
+
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Return the physical address of the user page at va,
+// for copyin/copyout: faulting in heap and mapped-file
+// pages that haven't been touched, and giving the page
+// its own copy first if write is set and it is
+// copy-on-write.
+// Returns 0 if va isn't a valid user address, if write
+// is set and the page is read-only, or if a mapped-file
+// page would have to be faulted in under a spinlock.
+static uint64
+uvmaddr(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V) && (write == 0 || (*pte & PTE_W)))
+    return walkaddr(pagetable, va);
+  if(pte && (*pte & PTE_V) && (*pte & PTE_COW)){
+    if(cowfault(pagetable, va) < 0)
+      return 0;
+    return walkaddr(pagetable, va);
+  }
+
+  // only the current process's memory is demand-paged.
+  if(p == 0 || p->pagetable != pagetable)
+    return 0;
+  if(uvmfault(pagetable, va, p->sz, write) == 0)
+    return walkaddr(pagetable, va);
+  // a mapped-file page may have to be read from disk, which
+  // can't be waited for while holding a spinlock, as pipes
+  // and the console do around copyin/copyout. callers
+  // uvmprefault() before taking such locks.
+  if(!intr_get() && mycpu()->noff > 0)
+    return 0;
+  if(mmapfault(p, va, write) < 0)
+    return 0;
+  return walkaddr(pagetable, va);
+}
+
+// Fault in the user pages of [va, va+len), for writing if
+// write is set, the way copyin/copyout would. Called before
+// taking a lock that a fault might need, such as the lock
+// of the file the pages map, or a spinlock, under which a
+// mapped-file page can't be faulted in at all. Stops at the first page that
+// can't be mapped; the copy will fail there anyway.
+void
+uvmprefault(pagetable_t pagetable, uint64 va, uint64 len, int write)
+{
+  uint64 a;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE)
+    if(uvmaddr(pagetable, a, write) == 0)
+      break;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -369,7 +510,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -394,7 +535,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -421,7 +562,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -18,12 +18,13 @@
 #define NINODES 200
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | inode bit map | free bit map | data blocks ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int nimap = NINODES/(BSIZE*8) + 1;
+int nlog = LOGBLOCKS;
+int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, inode bitmap, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
@@ -34,6 +35,7 @@ uint freeblock;
 
 
 void balloc(int);
+void imap(int);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
@@ -72,6 +74,7 @@ main(int argc, char *argv[])
   struct dirent de;
   char buf[BSIZE];
   struct dinode din;
+  struct loganchor la;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -83,6 +86,7 @@ main(int argc, char *argv[])
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert(sizeof(struct logheader) == BSIZE);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -91,7 +95,7 @@ main(int argc, char *argv[])
   }
 
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  nmeta = 2 + nlog + ninodeblocks + nimap + nbitmap;
   nblocks = FSSIZE - nmeta;
 
   sb.magic = FSMAGIC;
@@ -101,10 +105,12 @@ main(int argc, char *argv[])
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.imapstart = xint(2+nlog+ninodeblocks);
+  sb.bmapstart = xint(2+nlog+ninodeblocks+nimap);
+  sb.bsize = xint(BSIZE);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, inode bitmap blocks %u, bitmap blocks %u) blocks %d total %d of %d bytes\n",
+         nmeta, nlog, ninodeblocks, nimap, nbitmap, nblocks, FSSIZE, BSIZE);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
@@ -115,6 +121,14 @@ main(int argc, char *argv[])
   memmove(buf, &sb, sizeof(sb));
   wsect(1, buf);
 
+  // an empty log; the kernel numbers its transactions from 1.
+  memset(buf, 0, sizeof(buf));
+  la.magic = xint(LOGMAGIC);
+  la.seq = xint(1);
+  la.tail = xint(0);
+  memmove(buf, &la, sizeof(la));
+  wsect(2, buf);
+
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
@@ -171,6 +185,7 @@ main(int argc, char *argv[])
   winode(rootino, &din);
 
   balloc(freeblock);
+  imap(freeinode);
 
   exit(0);
 }
@@ -258,8 +273,68 @@ balloc(int used)
   wsect(sb.bmapstart, buf);
 }
 
+// Mark inodes 0 through used-1 allocated in the inode bit
+// map; inode 0 is never used.
+void
+imap(int used)
+{
+  uchar buf[BSIZE];
+  int i;
+
+  assert(used < BSIZE*8);
+  bzero(buf, BSIZE);
+  for(i = 0; i < used; i++){
+    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  }
+  wsect(sb.imapstart, buf);
+}
+
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the disk block holding block fbn of the file with
+// inode din, allocating it if fbn is the first block past
+// the end of the file. A new block extends the file's last
+// extent if it comes right after it.
+uint
+xbmap(struct dinode *din, uint fbn)
+{
+  struct extent spill[NSPILL], *e, *last;
+  uint i, lbn, x;
+
+  if(xint(din->spill))
+    rsect(xint(din->spill), spill);
+  else
+    bzero(spill, sizeof(spill));
+
+  lbn = 0;
+  last = 0;
+  for(i = 0; i < NEXTENT + NSPILL; i++){
+    e = i < NEXTENT ? &din->ext[i] : &spill[i - NEXTENT];
+    if(xint(e->len) == 0)
+      break;
+    if(fbn < lbn + xint(e->len))
+      return xint(e->start) + fbn - lbn;
+    lbn += xint(e->len);
+    last = e;
+  }
+  assert(fbn == lbn);
+
+  if(last && xint(last->start) + xint(last->len) == freeblock){
+    last->len = xint(xint(last->len) + 1);
+  } else {
+    assert(i < NEXTENT + NSPILL);
+    if(i >= NEXTENT && xint(din->spill) == 0)
+      din->spill = xint(freeblock++);
+    e->start = xint(freeblock);
+    e->len = xint(1);
+    last = e;
+  }
+  if(last >= spill && last < spill + NSPILL)
+    wsect(xint(din->spill), spill);
+  x = freeblock++;
+  return x;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -267,7 +342,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -276,22 +350,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = xbmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -21,7 +21,7 @@ void
 createfile(char *file, int nblock)
 {
   int fd;
-  char buf[BSIZE];
+  static char buf[BSIZE];
   int i;
   
   fd = open(file, O_CREATE | O_RDWR);
@@ -41,7 +41,7 @@ createfile(char *file, int nblock)
 void
 readfile(char *file, int nbytes, int inc)
 {
-  char buf[BSIZE];
+  static char buf[BSIZE];
   int fd;
   int i;
 
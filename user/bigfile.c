@@ -7,7 +7,7 @@
 int
 main()
 {
-  char buf[BSIZE];
+  static char buf[BSIZE];
   int fd, i, blocks;
 
   fd = open("big.file", O_CREATE | O_WRONLY);
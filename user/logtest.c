@@ -0,0 +1,145 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// Test the log: commits that wrap around the circular
+// buffer, and recovery after a crash.
+//
+//   logtest          commit enough to wrap the log many times
+//   logtest crash    wrap the log, then crash in a commit
+//   logtest torn     crash after writing only a commit's header
+//   logtest check    after rebooting from crash or torn, check
+//                    what recovery left
+
+#define NROUND 200  // well over LOGBLOCKS blocks logged
+#define NWFILE 4
+
+char buf[512];
+
+void
+fill(char *name, int c)
+{
+  int fd;
+
+  unlink(name);
+  if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+    printf("logtest: create %s failed\n", name);
+    exit(1);
+  }
+  memset(buf, c, sizeof(buf));
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("logtest: write %s failed\n", name);
+    exit(1);
+  }
+  close(fd);
+}
+
+int
+check(char *name, int c)
+{
+  int fd, i;
+
+  if((fd = open(name, O_RDONLY)) < 0){
+    printf("logtest: open %s failed\n", name);
+    return 0;
+  }
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("logtest: read %s failed\n", name);
+    close(fd);
+    return 0;
+  }
+  close(fd);
+  for(i = 0; i < sizeof(buf); i++){
+    if(buf[i] != c){
+      printf("logtest: %s has %d at %d, expected %d\n", name, buf[i], i, c);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Create, rewrite and remove files, each in its own
+// transactions, so that the log wraps around.
+void
+wrap(void)
+{
+  char name[] = "logtest.0";
+  int i;
+
+  for(i = 0; i < NROUND; i++){
+    name[8] = '0' + i % NWFILE;
+    fill(name, 'a' + i % 26);
+    if(!check(name, 'a' + i % 26)){
+      printf("logtest: FAILED\n");
+      exit(1);
+    }
+  }
+  for(i = NROUND - NWFILE; i < NROUND; i++){
+    name[8] = '0' + i % NWFILE;
+    if(!check(name, 'a' + i % 26)){
+      printf("logtest: FAILED\n");
+      exit(1);
+    }
+    if(unlink(name) < 0){
+      printf("logtest: unlink %s failed\n", name);
+      exit(1);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ok, fd;
+
+  if(argc < 2){
+    printf("logtest: start\n");
+    wrap();
+    printf("logtest: OK\n");
+    exit(0);
+  }
+
+  if(strcmp(argv[1], "crash") == 0){
+    wrap();
+    fill("logtest.a", 'x');
+    printf("logtest: crashing; reboot and run logtest check\n");
+    crash("logtest.r", 1);
+    printf("logtest: crash returned\n");
+    exit(1);
+  }
+
+  if(strcmp(argv[1], "torn") == 0){
+    fill("logtest.a", 'y');
+    printf("logtest: crashing; reboot and run logtest check\n");
+    crash("logtest.t", 2);
+    printf("logtest: crash returned\n");
+    exit(1);
+  }
+
+  if(strcmp(argv[1], "check") == 0){
+    ok = 1;
+    if((fd = open("logtest.r", O_RDONLY)) >= 0){
+      close(fd);
+      // after crash: the committed transactions are replayed.
+      if(!check("logtest.a", 'x'))
+        ok = 0;
+      unlink("logtest.r");
+    } else if((fd = open("logtest.t", O_RDONLY)) >= 0){
+      close(fd);
+      printf("logtest: torn commit was replayed\n");
+      ok = 0;
+      unlink("logtest.t");
+    } else if(!check("logtest.a", 'y')){
+      // after torn: the ones before it are.
+      ok = 0;
+    }
+    unlink("logtest.a");
+    printf(ok ? "logtest: OK\n" : "logtest: FAILED\n");
+    exit(ok ? 0 : 1);
+  }
+
+  printf("usage: logtest [crash | torn | check]\n");
+  exit(1);
+}
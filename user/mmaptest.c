@@ -59,8 +59,8 @@ _v1(char *p)
 void
 makefile(const char *f)
 {
-  int i;
-  int n = PGSIZE/BSIZE;
+  int i, m;
+  int n = PGSIZE + PGSIZE/2;
 
   unlink(f);
   int fd = open(f, O_WRONLY | O_CREATE);
@@ -68,8 +68,9 @@ makefile(const char *f)
     err("open");
   memset(buf, 'A', BSIZE);
   // write 1.5 page
-  for (i = 0; i < n + n/2; i++) {
-    if (write(fd, buf, BSIZE) != BSIZE)
+  for (i = 0; i < n; i += m) {
+    m = n - i < BSIZE ? n - i : BSIZE;
+    if (write(fd, buf, m) != m)
       err("write 0 makefile");
   }
   if (close(fd) == -1)
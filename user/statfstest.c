@@ -0,0 +1,163 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NBLK 8   // blocks written to the test file
+#define NFD 10   // files opened at once
+
+char buf[4096];
+
+// Create and remove a file and check that statfs()
+// counts its inode and blocks as used, then free again.
+void
+test0()
+{
+  struct statfs st0, st1, st2;
+  int fd, i;
+
+  printf("statfs: start\n");
+
+  // make sure the directory has room for the entry,
+  // so the only blocks used are the file's.
+  if((fd = open("statfs.f", O_CREATE|O_RDWR)) < 0){
+    printf("statfs: create failed\n");
+    exit(1);
+  }
+  close(fd);
+  unlink("statfs.f");
+
+  if(statfs("/", &st0) < 0){
+    printf("statfs: statfs failed\n");
+    exit(1);
+  }
+  if(st0.bsize > sizeof(buf) || st0.bfree > st0.nblocks || st0.ifree > st0.ninodes){
+    printf("statfs: bad counts, bsize %d bfree %d/%d ifree %d/%d\n",
+           st0.bsize, st0.bfree, st0.nblocks, st0.ifree, st0.ninodes);
+    printf("statfs: FAILED\n");
+    exit(1);
+  }
+
+  if((fd = open("statfs.f", O_CREATE|O_RDWR)) < 0){
+    printf("statfs: create failed\n");
+    exit(1);
+  }
+  memset(buf, 'a', sizeof(buf));
+  for(i = 0; i < NBLK; i++){
+    if(write(fd, buf, st0.bsize) != st0.bsize){
+      printf("statfs: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  if(statfs("/", &st1) < 0){
+    printf("statfs: statfs failed\n");
+    exit(1);
+  }
+  if(st1.ifree != st0.ifree - 1 || st1.bfree > st0.bfree - NBLK){
+    printf("statfs: after create, bfree %d -> %d ifree %d -> %d\n",
+           st0.bfree, st1.bfree, st0.ifree, st1.ifree);
+    printf("statfs: FAILED\n");
+    exit(1);
+  }
+
+  if(unlink("statfs.f") < 0){
+    printf("statfs: unlink failed\n");
+    exit(1);
+  }
+  if(statfs("/", &st2) < 0){
+    printf("statfs: statfs failed\n");
+    exit(1);
+  }
+  if(st2.ifree != st0.ifree || st2.bfree != st0.bfree){
+    printf("statfs: after unlink, bfree %d -> %d ifree %d -> %d\n",
+           st0.bfree, st2.bfree, st0.ifree, st2.ifree);
+    printf("statfs: FAILED\n");
+    exit(1);
+  }
+
+  printf("statfs: OK\n");
+}
+
+// Return the number of objects allocated from the
+// kernel object cache called name.
+int
+nalloc(char *name)
+{
+  struct kmemstat st[16];
+  int i, n;
+
+  n = kmemstat(st, 16);
+  if(n < 0){
+    printf("kmemstat: kmemstat failed\n");
+    exit(1);
+  }
+  for(i = 0; i < n && i < 16; i++)
+    if(strcmp(st[i].name, name) == 0)
+      return st[i].nalloc;
+  printf("kmemstat: no cache %s\n", name);
+  exit(1);
+}
+
+// Open and close files and pipes, and check that
+// kmemstat() sees their caches go back to where they were.
+void
+test1()
+{
+  int file0, pipe0, n;
+  int fds[NFD], pfds[2];
+  int i;
+
+  printf("kmemstat: start\n");
+
+  file0 = nalloc("file");
+  pipe0 = nalloc("pipe");
+
+  for(i = 0; i < NFD; i++){
+    if((fds[i] = open("README", O_RDONLY)) < 0){
+      printf("kmemstat: open failed\n");
+      exit(1);
+    }
+  }
+  if((n = nalloc("file")) != file0 + NFD){
+    printf("kmemstat: %d files open, expected %d\n", n, file0 + NFD);
+    printf("kmemstat: FAILED\n");
+    exit(1);
+  }
+  for(i = 0; i < NFD; i++)
+    close(fds[i]);
+  if((n = nalloc("file")) != file0){
+    printf("kmemstat: %d files open after close, expected %d\n", n, file0);
+    printf("kmemstat: FAILED\n");
+    exit(1);
+  }
+
+  if(pipe(pfds) < 0){
+    printf("kmemstat: pipe failed\n");
+    exit(1);
+  }
+  if((n = nalloc("pipe")) != pipe0 + 1){
+    printf("kmemstat: %d pipes, expected %d\n", n, pipe0 + 1);
+    printf("kmemstat: FAILED\n");
+    exit(1);
+  }
+  close(pfds[0]);
+  close(pfds[1]);
+  if((n = nalloc("pipe")) != pipe0 || nalloc("file") != file0){
+    printf("kmemstat: pipe not freed\n");
+    printf("kmemstat: FAILED\n");
+    exit(1);
+  }
+
+  printf("kmemstat: OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  test0();
+  test1();
+  exit(0);
+}
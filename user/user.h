@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct kmemstat;
+struct statfs;
 
 // system calls
 int fork(void);
@@ -24,6 +26,10 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int ntas();
+int kmemstat(struct kmemstat*, int);
+void *mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int statfs(const char*, struct statfs*);
 int crash(const char*, int);
 int mount(char*, char *);
 int umount(char*);
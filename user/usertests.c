@@ -334,6 +334,78 @@ exectest(char *s)
 
 }
 
+// write to a pipe from, and read from it into, file pages
+// mapped by mmap() that haven't been touched yet, which
+// have to be faulted in before the pipe's lock is taken.
+void
+mmappipe(char *s)
+{
+  enum { N = 100 };
+  int fd, fds[2], i;
+  char *p, *q;
+  char buf[N];
+
+  unlink("mmappipe");
+  fd = open("mmappipe", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create mmappipe failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'm', N);
+  for(i = 0; i < PGSIZE / N + 1; i++){
+    if(write(fd, buf, N) != N){
+      printf("%s: write mmappipe failed\n", s);
+      exit(1);
+    }
+  }
+  p = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+  q = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  unlink("mmappipe");
+  if(p == (char*)-1 || q == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+
+  if(write(fds[1], p, N) != N){
+    printf("%s: pipe write from mapped page failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], buf, N) != N){
+    printf("%s: pipe read failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(buf[i] != 'm'){
+      printf("%s: wrong data through pipe\n", s);
+      exit(1);
+    }
+  }
+
+  memset(buf, 'z', N);
+  if(write(fds[1], buf, N) != N){
+    printf("%s: pipe write failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], q, N) != N){
+    printf("%s: pipe read into mapped page failed\n", s);
+    exit(1);
+  }
+  if(q[0] != 'z' || q[N-1] != 'z' || q[N] != 'm'){
+    printf("%s: wrong data in mapped page\n", s);
+    exit(1);
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+  munmap(p, PGSIZE);
+  munmap(q, PGSIZE);
+}
+
 // simple fork and pipe read/write
 
 void
@@ -1124,6 +1196,148 @@ bigdir(char *s)
   }
 }
 
+// create, look up, and remove many files in a directory,
+// and check that removed names aren't found any more.
+void
+createlookup(char *s)
+{
+  enum { N = 200 };
+  int i, fd;
+  char name[8];
+
+  if(mkdir("cl") != 0){
+    printf("%s: mkdir cl failed\n", s);
+    exit(1);
+  }
+  name[0] = 'c';
+  name[1] = 'l';
+  name[2] = '/';
+  name[5] = '\0';
+  for(i = 0; i < N; i++){
+    name[3] = '0' + (i / 64);
+    name[4] = '0' + (i % 64);
+    fd = open(name, O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  for(i = 0; i < N; i++){
+    name[3] = '0' + (i / 64);
+    name[4] = '0' + (i % 64);
+    fd = open(name, O_RDONLY);
+    if(fd < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    if(i % 2 == 0 && unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[3] = '0' + (i / 64);
+    name[4] = '0' + (i % 64);
+    fd = open(name, O_RDONLY);
+    if(i % 2 == 0 && fd >= 0){
+      printf("%s: open unlinked %s succeeded\n", s, name);
+      exit(1);
+    }
+    if(i % 2 == 1 && fd < 0){
+      printf("%s: open %s failed after unlinks\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    if(i % 2 == 1 && unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("cl") != 0){
+    printf("%s: unlink cl failed\n", s);
+    exit(1);
+  }
+}
+
+// look up names that don't exist, then create them,
+// and check that the failed lookups aren't remembered.
+void
+negentry(char *s)
+{
+  int fd;
+
+  unlink("neg");
+  if(open("neg", O_RDONLY) >= 0){
+    printf("%s: open neg succeeded before create\n", s);
+    exit(1);
+  }
+  fd = open("neg", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create neg failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("neg", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open neg failed after create\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // by link.
+  if(open("neg2", O_RDONLY) >= 0){
+    printf("%s: open neg2 succeeded before link\n", s);
+    exit(1);
+  }
+  if(link("neg", "neg2") != 0){
+    printf("%s: link neg neg2 failed\n", s);
+    exit(1);
+  }
+  fd = open("neg2", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open neg2 failed after link\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("neg2");
+
+  // by mkdir, in a directory that was removed and made again.
+  if(mkdir("negd") != 0){
+    printf("%s: mkdir negd failed\n", s);
+    exit(1);
+  }
+  if(open("negd/f", O_RDONLY) >= 0){
+    printf("%s: open negd/f succeeded before create\n", s);
+    exit(1);
+  }
+  if(unlink("negd") != 0 || mkdir("negd") != 0){
+    printf("%s: remake negd failed\n", s);
+    exit(1);
+  }
+  if(mkdir("negd/f") != 0){
+    printf("%s: mkdir negd/f failed\n", s);
+    exit(1);
+  }
+  if(chdir("negd/f") != 0){
+    printf("%s: chdir negd/f failed\n", s);
+    exit(1);
+  }
+  if(chdir("/") != 0){
+    printf("%s: chdir / failed\n", s);
+    exit(1);
+  }
+  if(unlink("negd/f") != 0 || unlink("negd") != 0 || unlink("neg") != 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+  if(open("neg", O_RDONLY) >= 0){
+    printf("%s: open neg succeeded after unlink\n", s);
+    exit(1);
+  }
+}
+
 void
 subdir(char *s)
 {
@@ -2137,6 +2351,8 @@ main(int argc, char *argv[])
     {createdelete, "createdelete"},
     {linkunlink, "linkunlink"},
     {linktest, "linktest"},
+    {createlookup, "createlookup"},
+    {negentry, "negentry"},
     {unlinkread, "unlinkread"},
     {concreate, "concreate"},
     {subdir, "subdir"},
@@ -2162,6 +2378,7 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {mmappipe, "mmappipe"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
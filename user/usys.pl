@@ -37,3 +37,8 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("ntas");
+entry("kmemstat");
+entry("mmap");
+entry("munmap");
+entry("statfs");
+entry("crash");